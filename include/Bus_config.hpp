@@ -0,0 +1,68 @@
+#pragma once
+
+#include <Arduino.h>
+#include <stdint.h>
+#include <Modbus_RTU.hpp>
+
+// RS-485 bus of the module: UART, pins of its MAX485 transceiver and line settings.
+// Defaults match the wiring scheme, i.e. UART2 on its default pins.
+struct Bus_config
+{
+  // UART0 is left to the debug console
+  static constexpr uint8_t max_buses = 2;
+
+  static constexpr uint8_t default_uart = 2;
+  static constexpr int8_t default_pin = -1;   // default RX/TX pin of the UART
+  static constexpr uint8_t default_de_pin = 19;
+  static constexpr uint8_t default_re_neg_pin = 21;
+  static constexpr unsigned long default_baud_rate = 19200;
+
+  uint8_t uart;
+  int8_t rx_pin;
+  int8_t tx_pin;
+  uint8_t de_pin;
+  uint8_t re_neg_pin;
+  unsigned long baud_rate;
+  Modbus_RTU::Parity parity;
+  uint32_t response_timeout_ms;
+
+  bool operator==(const Bus_config& other) const
+  {
+    return uart == other.uart && rx_pin == other.rx_pin && tx_pin == other.tx_pin
+      && de_pin == other.de_pin && re_neg_pin == other.re_neg_pin && baud_rate == other.baud_rate
+      && parity == other.parity && response_timeout_ms == other.response_timeout_ms;
+  }
+
+  bool operator!=(const Bus_config& other) const
+  {
+    return !(*this == other);
+  }
+
+  // UART frame format, 8 data bits and 1 stop bit
+  uint32_t serial_config() const
+  {
+    switch (parity)
+    {
+      case Modbus_RTU::Parity::EVEN:
+        return SERIAL_8E1;
+      case Modbus_RTU::Parity::ODD:
+        return SERIAL_8O1;
+      default:
+        return SERIAL_8N1;
+    }
+  }
+
+  // UART of the bus, nullptr if it cannot be used for a bus
+  HardwareSerial* serial() const
+  {
+    switch (uart)
+    {
+      case 1:
+        return &Serial1;
+      case 2:
+        return &Serial2;
+      default:
+        return nullptr;
+    }
+  }
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <stdint.h>
+#include <ArduinoJson.h>
+#include "H300.hpp"
+
+// Descriptor of a datapoint, maps the datapoint code to its register and
+// describes how the raw register value is decoded and encoded.
+class Datapoint
+{
+  public:
+    enum class Type : uint8_t
+    {
+      NUMBER,   // value = raw * multiplier / divisor
+      INTEGER,  // value = raw
+      ENUM,     // value = labels[raw - label_base]
+      STATE     // "OK" for zero, "ERROR %N" otherwise
+    };
+
+    const char* const code;
+    const uint16_t register_addr;
+    const Type type;
+    const uint16_t multiplier;
+    const uint16_t divisor;
+    const bool readable;
+    const bool writable;
+    const char* const* const labels;
+    const uint8_t label_count;
+    const uint8_t label_base;
+
+    constexpr Datapoint(
+      const char* const code,
+      const uint16_t register_addr,
+      const Type type,
+      const uint16_t multiplier,
+      const uint16_t divisor,
+      const bool readable,
+      const bool writable,
+      const char* const* const labels = nullptr,
+      const uint8_t label_count = 0,
+      const uint8_t label_base = 0
+    ) : code(code), register_addr(register_addr), type(type), multiplier(multiplier),
+        divisor(divisor), readable(readable), writable(writable), labels(labels),
+        label_count(label_count), label_base(label_base) {}
+
+    void decode(const uint16_t raw, JsonObject& object) const;
+    bool encode(const char* const value, uint16_t* const raw) const;
+    uint16_t raw_delta(const float delta) const;
+
+    static const Datapoint* find(const char* const code);
+};
+
+// Datapoint table, single definition in Datapoint.cpp
+class Datapoints
+{
+  public:
+    static constexpr const char* get_motion_labels[] = { "FWD", "REV", "STOP" };
+    static constexpr const char* set_motion_labels[] = {
+      "FWD", "REV", "FWD_JOG", "REV_JOG", "STOP", "BREAK"
+    };
+
+    static constexpr Datapoint table[] = {
+      //        code          register                   type                      mul  div  read   write
+      Datapoint("SPEED",      H300::speed_register,      Datapoint::Type::NUMBER,  1,   10,  true,  true),
+      Datapoint("SET_MOTION", H300::set_motion_register, Datapoint::Type::ENUM,    1,   1,   false, true,
+        set_motion_labels, 6, 1),
+      Datapoint("GET_MOTION", H300::get_motion_register, Datapoint::Type::ENUM,    1,   1,   true,  false,
+        get_motion_labels, 3, 1),
+      Datapoint("STATE",      H300::state_register,      Datapoint::Type::STATE,   1,   1,   true,  false),
+      Datapoint("GET_FREQ",   H300::get_freq_register,   Datapoint::Type::NUMBER,  1,   100, true,  false),
+      Datapoint("SET_FREQ",   H300::set_freq_register,   Datapoint::Type::NUMBER,  1,   100, true,  true),
+      Datapoint("ACCEL_TIME", H300::accel_time_register, Datapoint::Type::INTEGER, 1,   1,   true,  true),
+      Datapoint("DECEL_TIME", H300::decel_time_register, Datapoint::Type::INTEGER, 1,   1,   true,  true),
+      Datapoint("GET_TIMER",  H300::get_timer_register,  Datapoint::Type::NUMBER,  1,   10,  true,  false),
+      Datapoint("SET_TIMER",  H300::set_timer_register,  Datapoint::Type::NUMBER,  1,   10,  true,  true),
+      // RPM of 4-pole motor with no load: GET_FREQ * 60 * 2 / 4
+      Datapoint("RPM",        H300::get_freq_register,   Datapoint::Type::NUMBER,  30,  100, true,  false)
+    };
+
+    static constexpr uint8_t count = sizeof(table) / sizeof(table[0]);
+
+    // bit mask of the readable datapoints by table index
+    static constexpr uint16_t readable_mask(const uint8_t index = 0)
+    {
+      return index == count ? 0 : (table[index].readable ? 1u << index : 0) | readable_mask(index + 1);
+    }
+};
+
+static_assert(Datapoints::count <= H300::max_datapoints, "H300::max_datapoints too small for the table");
+
+// Perfect hash of the datapoint codes: seeded FNV-1a, slot taken from the top bits.
+// Seed was searched so that no two codes share a slot, checked by the static_assert below.
+namespace Datapoint_hash
+{
+  constexpr uint8_t slot_bits = 4;
+  constexpr uint8_t slot_count = 1 << slot_bits;
+  constexpr uint32_t seed = 103;
+
+  constexpr uint32_t hash(const char* const code, const uint32_t state = seed)
+  {
+    return *code ? hash(code + 1, (state ^ uint8_t(*code)) * 16777619u) : state;
+  }
+
+  constexpr uint8_t slot(const char* const code)
+  {
+    return hash(code) >> (32 - slot_bits);
+  }
+
+  // index of the datapoint occupying the slot, -1 if the slot is empty
+  constexpr int8_t slot_entry(const uint8_t slot_index, const uint8_t index = 0)
+  {
+    return index == Datapoints::count ? -1
+      : slot(Datapoints::table[index].code) == slot_index ? index
+      : slot_entry(slot_index, index + 1);
+  }
+
+  constexpr bool collision_free(const uint8_t index = 0)
+  {
+    return index == Datapoints::count
+      || (slot_entry(slot(Datapoints::table[index].code)) == index && collision_free(index + 1));
+  }
+
+  static_assert(collision_free(), "datapoint codes collide in the hash table, change the seed");
+
+  template <uint8_t... I> struct index_list {};
+  template <uint8_t N, uint8_t... I> struct make_index_list : make_index_list<N - 1, N - 1, I...> {};
+  template <uint8_t... I> struct make_index_list<0, I...> { typedef index_list<I...> type; };
+
+  template <typename> struct slot_table;
+  template <uint8_t... I> struct slot_table<index_list<I...>>
+  {
+    static constexpr int8_t slots[sizeof...(I)] = { slot_entry(I)... };
+  };
+
+  template <uint8_t... I> constexpr int8_t slot_table<index_list<I...>>::slots[sizeof...(I)];
+
+  typedef slot_table<make_index_list<slot_count>::type> lookup;
+};
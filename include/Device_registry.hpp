@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "Bus_config.hpp"
+
+// Device ids and units of a configuration, the index of a device is its index in the
+// poller device set. Ids are hashed into an open addressing table as they are added and
+// units have a direct table per bus, so both lookups take constant time.
+// Duplicate ids, duplicate units on one bus and units outside 1..247 are refused.
+class Device_registry
+{
+  public:
+    static constexpr uint16_t not_found = 0xFFFF;
+
+    enum class Result : uint8_t
+    {
+      ADDED,
+      DUPLICATE_ID,
+      DUPLICATE_UNIT,
+      INVALID   // bus or unit out of range or registry full
+    };
+
+    Device_registry();
+
+    void clear();
+    void reserve(const uint16_t count);
+    Result add(const char* const device_id, const uint8_t bus_index, const uint8_t unit_id);
+    uint16_t find(const char* const device_id) const;
+    uint16_t find_unit(const uint8_t bus_index, const uint8_t unit_id) const;
+    void swap(Device_registry& other);
+
+    const std::string& id(const uint16_t index) const { return ids[index]; }
+    uint16_t size() const { return ids.size(); }
+
+  private:
+    static constexpr uint16_t unit_count = 256;
+
+    std::vector<std::string> ids;
+    std::vector<uint32_t> hashes;  // by device index
+    std::vector<uint16_t> slots;   // device index by hash slot, power of two in size
+    std::vector<uint16_t> units;   // device index by bus_index * unit_count + unit_id
+
+    uint16_t find(const char* const device_id, const size_t length, const uint32_t hash) const;
+    void rehash(const size_t slot_count);
+
+    static uint32_t hash(const char* const device_id, size_t* const length);
+};
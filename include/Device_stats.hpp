@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <Modbus_RTU.hpp>
+
+// Modbus transactions of one device since the stats were last taken. Latency of the
+// answered requests is kept in a histogram with two buckets per octave, so percentiles
+// are reported as the upper bound of their bucket, at most 50 % above the real value.
+struct Device_stats
+{
+  static constexpr uint8_t latency_buckets = 24;
+  static constexpr uint32_t min_latency_us = 256;   // upper bound of the first bucket
+
+  uint16_t transactions;
+  uint16_t timeouts;
+  uint16_t crc_errors;
+  uint16_t exceptions[4];     // exception responses by code, illegal function to slave device failure
+  uint16_t other_errors;      // garbled responses, e.g. of another unit
+  uint16_t latency_histogram[latency_buckets];
+
+  Device_stats() : transactions(0), timeouts(0), crc_errors(0), exceptions(), other_errors(0), latency_histogram() {}
+
+  void record(const Modbus_RTU::Transaction& transaction);
+  uint32_t percentile_us(const uint8_t percent) const;
+  uint16_t answered() const;
+
+  static uint8_t bucket(const uint32_t latency_us);
+  static uint32_t bucket_limit_us(const uint8_t bucket);
+};
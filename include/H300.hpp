@@ -1,26 +1,37 @@
 #pragma once
 
 #include <stdint.h>
-#include <ModbusMaster.h>
+#include <string>
+#include <Modbus_RTU.hpp>
+#include "Device_stats.hpp"
+#include "Read_planner.hpp"
 
 class H300 
 {
   private:
-    mutable ModbusMaster node;
+    Modbus_RTU* bus;
+    Read_planner* scan_planner;
+    uint8_t scan_pending;
+    uint16_t scan_registers;
 
-    static constexpr unsigned long baud_rate = 19200;
-    static constexpr HardwareSerial& serial_bus = Serial2;
-    static constexpr uint8_t MAX485_DE = 19;
-    static constexpr uint8_t MAX485_RE_NEG = 21;
+    static void scan_callback(void* context, const Modbus_RTU::Transaction& transaction);
+    static void probe_callback(void* context, const Modbus_RTU::Transaction& transaction);
 
-    static void pre_transmission();
-    static void post_transmission();
-
-    uint32_t iteration_counter;
   public:
+    enum class Health : uint8_t
+    {
+      ONLINE,   // answered its last scan
+      SUSPECT,  // last scans were not answered, read with the full bus timeout
+      OFFLINE   // only probed by a single read, less and less often
+    };
+
+    const uint8_t bus_index;
     const std::string device_id;
     const uint8_t unit_id;
-    const uint32_t poll_rate;
+    const uint32_t poll_rate;  // ms
+
+    // typical processing delay of the drive before it starts to respond
+    static constexpr uint32_t response_delay_us = 10000;
     
     static constexpr uint16_t speed_register = 		0x1000; // writable
     static constexpr uint16_t state_register = 		0x8000;
@@ -32,9 +43,115 @@ class H300
     static constexpr uint16_t decel_time_register = 	0xF012;	// writable
     static constexpr uint16_t get_timer_register = 	0x1015;
     static constexpr uint16_t set_timer_register =	0xF82C; // writable
+
+    static constexpr uint16_t motion_break = 6;    // SET_MOTION stop using breaks
+    static constexpr uint16_t motion_stopped = 3;  // GET_MOTION stop
+
+    static constexpr uint8_t max_datapoints = 16;
+    static constexpr uint32_t default_snapshot_interval = 60000;
+
+    // configuration registers changed only by writes of this module
+    static constexpr uint16_t cached_registers[] = {
+      set_freq_register, accel_time_register, decel_time_register, set_timer_register
+    };
+    static constexpr uint8_t cached_count = sizeof(cached_registers) / sizeof(cached_registers[0]);
+    static constexpr uint32_t default_revalidate_interval = 600000;
+
+    static constexpr uint8_t offline_after = 3;            // unanswered scans in a row
+    static constexpr uint32_t min_probe_interval = 1000;   // ms, doubled by every unanswered probe
+    static constexpr uint32_t max_probe_interval = 64000;
+    static constexpr uint32_t min_first_byte_timeout_us = 2 * response_delay_us;
+
+    // values of the last scan, indexed by planner register index
+    uint16_t scan_values[Read_planner::max_registers];
+    uint16_t scan_valid;
+
+    // report-by-exception settings, indexed by datapoint table index
+    uint16_t deadbands[max_datapoints];  // raw units, change must exceed it to be published
+    uint32_t snapshot_interval;          // ms between full updates, 0 publishes every poll
+
+    // per-datapoint polling, indexed by datapoint table index
+    uint32_t poll_rates[max_datapoints];  // ms, 0 polls the datapoint with the device poll_rate
+    uint16_t enabled_datapoints;          // datapoints which are read and published
+
+    uint32_t revalidate_interval;  // ms after which cached registers are read from the drive again
+
+    Device_stats stats;  // transactions since the poller last took the stats
     
-    H300(const std::string device_id, const uint8_t unit_id, const uint32_t poll_rate);
-    uint8_t write_value(const uint16_t register_addr, const uint16_t value) const;
-    uint8_t read_value(const uint16_t register_addr, uint16_t* const response) const;
-    bool decrease_counter();
+    H300(const uint8_t bus_index, const std::string device_id, const uint8_t unit_id, const uint32_t poll_rate);
+    void attach(Modbus_RTU& bus);
+    void take_state(const H300& previous);
+    bool write_value(
+      const uint16_t register_addr,
+      const uint16_t value,
+      Modbus_RTU::Callback callback,
+      void* const context = nullptr,
+      const uint32_t tag = 0
+    ) const;
+    bool write_values(
+      const uint16_t start,
+      const uint8_t count,
+      const uint16_t* const values,
+      Modbus_RTU::Callback callback,
+      void* const context = nullptr,
+      const uint32_t tag = 0
+    ) const;
+    bool read_value(
+      const uint16_t register_addr,
+      Modbus_RTU::Callback callback,
+      void* const context = nullptr,
+      const uint32_t tag = 0
+    ) const;
+    bool start_scan(Read_planner& planner, const uint16_t registers);
+    bool start_probe();
+    bool scan_complete() const;
+    Health health() const;
+    bool probe_due(const uint32_t now) const;
+    bool take_offline_report();
+    uint32_t first_byte_timeout_us() const;
+    void record(const Modbus_RTU::Transaction& transaction);
+    uint32_t scan_period() const;
+    uint16_t due_datapoints(const uint32_t now) const;
+    void mark_polled(const uint16_t datapoints, const uint32_t now);
+
+    bool cache_lookup(const uint16_t register_addr, uint16_t* const value) const;
+    void cache_store(const uint16_t register_addr, const uint16_t value, const uint32_t now);
+    void invalidate_cache(const uint16_t register_addr);
+    void invalidate_cache();
+    void expire_cache(const uint32_t now);
+    uint16_t report_changes(const uint16_t* const raw, const uint16_t valid, const uint32_t now) const;
+    void mark_reported(const uint16_t* const raw, const uint16_t report, const uint32_t now);
+    void force_snapshot();
+
+  private:
+    // last published values, indexed by datapoint table index
+    uint16_t published[max_datapoints];
+    uint16_t published_valid;
+    uint32_t last_snapshot;
+    bool snapshot_taken;
+
+    bool snapshot_due(const uint32_t now) const;
+
+    uint32_t last_polled[max_datapoints];
+    uint16_t polled_once;
+
+    // write-through cache, indexed by cached_registers index
+    uint16_t cache_values[cached_count];
+    uint32_t cache_since[cached_count];
+    uint8_t cache_valid;
+
+    Health health_state;
+    uint8_t unanswered_scans;
+    bool scan_answered;
+    bool offline_report;
+    uint32_t probe_interval;
+    uint32_t last_probe;
+
+    // smoothed delay of the first response byte and its mean deviation, 0 until answered
+    uint32_t first_byte_avg_us;
+    uint32_t first_byte_dev_us;
+
+    void finish_scan(const uint32_t now);
+
+    static int8_t cache_index(const uint16_t register_addr);
 };
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <Arduino.h>
+
+// debug mode, set to 0 if making a release, 2 also traces every sample read
+#ifndef DEBUG
+  #define DEBUG 1
+#endif
+
+// Logging macro used in debug mode
+#if DEBUG >= 1
+  #define LOG(message) Serial.println(message);
+  #define LOGF(...) Serial.printf(__VA_ARGS__);
+#else
+  #define LOG(message)
+  #define LOGF(...)
+#endif
+
+// Logging on the paths of every sample, the serial port would not keep up otherwise
+#if DEBUG >= 2
+  #define TRACEF(...) Serial.printf(__VA_ARGS__);
+#else
+  #define TRACEF(...)
+#endif
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <Arduino.h>
+#include <stdint.h>
+#include <FW_updater.hpp>
+#include <MQTT_client.hpp>
+#include "Device_registry.hpp"
+#include "Poller.hpp"
+
+// Inbound MQTT messages of the module: REQUEST, SET_CONFIG, SET_VALUE and UPDATE_FW, along
+// with the device set they maintain and the REQUEST_RESULT of writes the poller finished.
+// Built apart from main.cpp, so that the benchmarks run the same handlers as the firmware.
+namespace MQTT_handlers
+{
+  // reserve_buffers is called whenever the device count or the encoding changes
+  void setup(Poller* const poller, void (*reserve_buffers)());
+  void connect(MQTT_client* const mqtt_client, FW_updater* const fw_updater, const String& module_mac);
+  void publish_results();
+
+  // ids of the devices handed over to the poller, index matches the poller device set
+  const Device_registry& device_registry();
+  uint32_t config_generation();
+  MQTT_client::Encoding value_encoding();
+}
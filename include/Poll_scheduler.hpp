@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <queue>
+#include <vector>
+
+// Deadline based poll scheduler. Every device has a next-due timestamp on the
+// monotonic millisecond clock, kept in a priority queue. Devices sharing a poll
+// rate are spread over the period so they are not all due at the same time.
+class Poll_scheduler
+{
+  public:
+    struct Stats
+    {
+      uint32_t polls;
+      uint32_t skipped;             // periods missed completely because the bus was busy
+      uint32_t max_lateness_ms;
+      uint32_t total_lateness_ms;
+      uint32_t max_jitter_ms;       // max deviation of the poll interval from the period
+    };
+
+    static constexpr uint32_t min_period_ms = 10;
+    static constexpr uint16_t new_device = 0xFFFF;
+
+    void reset(const std::vector<uint32_t>& periods_ms, const uint32_t now);
+    void reschedule(
+      const std::vector<uint32_t>& periods_ms,
+      const std::vector<uint16_t>& previous_indices,
+      const uint32_t now
+    );
+    bool pop_due(const uint32_t now, uint16_t* const device_index);
+    uint32_t until_due(const uint32_t now) const;
+    bool empty() const { return queue.empty(); }
+
+    Stats take_stats();
+
+  private:
+    struct Entry
+    {
+      uint32_t due;
+      uint16_t device_index;
+    };
+
+    // wrap-around safe ordering of the timestamps, earliest first
+    struct Later
+    {
+      bool operator()(const Entry& a, const Entry& b) const
+      {
+        return int32_t(a.due - b.due) > 0;
+      }
+    };
+
+    std::priority_queue<Entry, std::vector<Entry>, Later> queue;
+    std::vector<uint32_t> periods;
+    std::vector<uint32_t> last_polled;
+    std::vector<bool> polled;
+
+    Stats stats = {};
+};
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <Arduino.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include <Modbus_RTU.hpp>
+#include <SPSC_ring.hpp>
+#include "Bus_config.hpp"
+#include "H300.hpp"
+#include "Datapoint.hpp"
+#include "Poll_scheduler.hpp"
+#include "Read_planner.hpp"
+
+// Values of one device scan, raw register values indexed by datapoint table index
+struct Sample
+{
+  uint32_t generation;
+  uint16_t device_index;
+  bool offline;     // device stopped answering, sent once and without values
+  uint16_t valid;
+  uint16_t raw[Datapoints::count];
+};
+
+struct Command
+{
+  enum class Type : uint8_t
+  {
+    WRITE,
+    STOP
+  };
+
+  Type type;
+  bool verify;        // STOP: read back the motion state of every device
+  bool batch_follows; // WRITE: next command is a write of the same batch
+  uint32_t generation;
+  uint16_t device_index;
+  uint16_t register_addr;
+  uint16_t value;
+  uint16_t sequence_number;
+  uint16_t batch_id;     // WRITE: batched SET_VALUE of the write, 0 for a single one
+  uint32_t received_us;  // STOP: request received, the stop latency is measured from it
+};
+
+struct Command_result
+{
+  uint16_t sequence_number;
+  uint16_t batch_id;    // of the command, sequence numbers alone may be reused meanwhile
+  uint8_t result;
+  uint32_t latency_us;  // reported for stop only, 0 otherwise
+};
+
+// Modbus transaction latency and device scans of one bus over the last stats interval
+struct Bus_stats
+{
+  uint8_t bus_index;
+  Modbus_RTU::Latency_stats latency;
+  uint32_t scans;
+  uint32_t scan_total_us;  // from the first read of a device scan to its last response
+  uint32_t scan_max_us;
+};
+
+// Device set handed over to the poller, generation identifies it in samples and commands
+struct Device_config
+{
+  uint32_t generation;
+  std::vector<H300>* devices;
+  Bus_config buses[Bus_config::max_buses];
+  uint8_t bus_count;
+};
+
+// Scans the devices and executes write commands on its own FreeRTOS task.
+// The device set and the buses are owned by the poller, the MQTT side talks
+// to it only through the lock-free rings below. Every bus has its own schedule
+// and all buses are scanned at the same time.
+class Poller
+{
+  public:
+    // device_index of the sample marking the end of a device pass, see end_pass()
+    static constexpr uint16_t end_of_pass = 0xFFFF;
+    // longest pass on a bus which never runs out of due devices
+    static constexpr uint32_t max_pass_ms = 1000;
+    static constexpr uint32_t stats_interval_ms = 10000;
+
+    // results of commands which never reached the bus
+    static constexpr uint8_t stale_config = 0xF0;
+    static constexpr uint8_t queue_full = 0xF1;
+    static constexpr uint8_t cancelled = 0xF3;
+
+    // writes waiting for the bus, pending writes of one register are coalesced
+    static constexpr uint8_t max_writes = 16;
+    // runs of consecutive sequence numbers superseded by the pending write of a register
+    static constexpr uint8_t max_superseded = 4;
+
+    SPSC_ring<Sample, 32> samples;           // poller -> MQTT
+    SPSC_ring<Command_result, 32> results;   // poller -> MQTT
+    SPSC_ring<Command, 16> commands;         // MQTT -> poller
+    SPSC_ring<Device_config, 4> configs;     // MQTT -> poller
+    SPSC_ring<Poll_scheduler::Stats, 2> schedule_stats;  // poller -> MQTT
+    SPSC_ring<Bus_stats, 4> bus_stats;       // poller -> MQTT
+    std::atomic<bool> standby_mode;
+    std::atomic<bool> revalidate_caches;     // read cached registers from the drives again
+    std::atomic<bool> resync_values;         // values were lost on the MQTT side, report all again
+
+    Poller(const Read_planner& planner, const uint32_t idle_delay_ms);
+
+    bool start(const BaseType_t core);
+    void wake();
+    uint32_t poll();
+    bool take_device_stats(std::vector<Device_stats>& stats, uint32_t* const stats_generation);
+
+  private:
+    struct Stop_request
+    {
+      Poller* poller;
+      uint16_t sequence_number;
+      uint16_t pending;
+      uint8_t result;
+      bool verify;
+      uint32_t generation;
+      uint32_t received_us;
+      uint16_t verify_positions[Bus_config::max_buses];  // next device to read back, by bus
+    };
+
+    // sequence numbers first to first + count - 1, all of the same batch
+    struct Sequence_run
+    {
+      uint16_t first;
+      uint16_t count;
+      uint16_t batch_id;
+    };
+
+    // Write waiting for its bus or on it. Until it is issued, a newer write to the
+    // same register replaces its value and the older command waits for its result.
+    struct Write_request
+    {
+      Poller* poller;
+      bool pending;
+      bool issued;
+      uint32_t order;
+      uint32_t generation;
+      uint16_t device_index;
+      uint16_t register_addr;
+      uint16_t value;
+      uint16_t sequence_number;
+      uint16_t batch_id;
+      Sequence_run superseded[max_superseded];
+      uint8_t superseded_count;
+      Write_request* next;  // write of the next register in the same frame
+    };
+
+    // devices on one bus, scanned one after another
+    struct Lane
+    {
+      Bus_config config;
+      Modbus_RTU* bus;
+      Read_planner planner;
+      Poll_scheduler scheduler;
+      std::vector<uint16_t> device_indices;
+      H300* scanned_device;
+      bool probing;     // scanned device is offline, only probed
+      uint32_t scan_started_us;
+      Bus_stats stats;  // scans since the stats were last pushed
+
+      Lane();
+    };
+
+    const Read_planner& planner;   // registers scanned on every bus
+    const uint32_t idle_delay_ms;
+    TaskHandle_t task_handle;
+
+    std::vector<H300>* devices;
+    uint32_t generation;
+
+    Lane lanes[Bus_config::max_buses];
+    uint8_t lane_count;
+    uint32_t stats_since;
+
+    // samples of the pass in progress, every device is in a pass at most once
+    uint16_t pass_samples;
+    uint32_t pass_started;
+    std::vector<bool> pass_devices;  // by device index
+
+    // device stats of the last interval, owned by the MQTT side while ready
+    std::vector<Device_stats> device_stats;
+    uint32_t device_stats_generation;
+    std::atomic<bool> device_stats_ready;
+
+    Stop_request stop_requests[4];
+    Write_request write_requests[max_writes];
+    uint32_t write_order;
+    bool batch_open;   // writes are held back until the whole batch is queued
+
+    void apply_configs();
+    void map_devices(
+      std::vector<H300>& config_devices,
+      const bool* const reopened,
+      std::vector<uint16_t>& previous_indices,
+      std::vector<uint16_t>& lane_positions
+    );
+    void open_lane(Lane& lane, const Bus_config& config);
+    void close_lane(Lane& lane);
+    void execute_commands();
+    void queue_write(const Command& command);
+    void issue_write(const uint8_t lane_index);
+    void finish_write(Write_request& request, const uint8_t result);
+    void execute_stop(const Command& command);
+    void verify_next(Stop_request& stop_request, const uint8_t lane_index);
+    void finish_stop(Stop_request& stop_request);
+    uint32_t scan(Lane& lane);
+    void push_sample(const Read_planner& lane_planner, const uint16_t device_index, H300& device);
+    void push_offline(const uint16_t device_index);
+    bool push_pass_sample(const Sample& sample);
+    bool end_pass();
+    uint16_t register_mask(const Read_planner& lane_planner, const H300& device, const uint16_t datapoints) const;
+    Poll_scheduler::Stats take_stats();
+    void push_stats();
+    void push_result(
+      const uint16_t sequence_number,
+      const uint16_t batch_id,
+      const uint8_t result,
+      const uint32_t latency_us = 0
+    );
+
+    static void task(void* parameter);
+    static void write_callback(void* context, const Modbus_RTU::Transaction& transaction);
+    static void stop_callback(void* context, const Modbus_RTU::Transaction& transaction);
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <Modbus_RTU.hpp>
+
+// Groups holding registers into as few multi-register reads as possible.
+// Two registers are read in one transaction when transferring the gap between
+// them is cheaper than the overhead of a separate request/response frame.
+class Read_planner
+{
+  public:
+    struct Range
+    {
+      uint16_t start;
+      uint8_t count;
+    };
+
+    static constexpr uint8_t max_registers = 16;
+    static constexpr uint8_t max_span = 64; // Modbus_RTU response buffer size
+
+    Read_planner(const Modbus_RTU::Timing& timing, const uint32_t response_delay_us);
+
+    bool add_register(const uint16_t register_addr);
+    uint8_t register_count() const { return registers_count; }
+    uint16_t register_at(const uint8_t index) const { return registers[index]; }
+    int8_t index_of(const uint16_t register_addr) const;
+
+    uint8_t range_count() const { return ranges_count; }
+    const Range& range_at(const uint8_t index) const { return ranges[index]; }
+    void split_range(const uint8_t index);
+
+    uint32_t transaction_us(const uint8_t register_count) const;
+    uint32_t naive_scan_us() const;
+    uint32_t planned_scan_us() const;
+
+  private:
+    uint16_t registers[max_registers];
+    uint8_t registers_count;
+
+    Range ranges[max_registers];
+    uint8_t ranges_count;
+
+    uint32_t char_us;
+    uint32_t frame_overhead_us;
+
+    void plan();
+};
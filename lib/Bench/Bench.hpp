@@ -0,0 +1,127 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Minimal benchmark harness: runs an operation until the minimal time has passed and
+// reports time and heap allocations per operation. Results can be saved as baseline
+// and compared against one, regressions above the threshold fail the run.
+namespace Bench
+{
+  struct Result
+  {
+    std::string name;
+    uint16_t devices;
+    double ns_per_op;
+    double allocs_per_op;
+  };
+
+  // heap allocations so far, counted by the malloc hooks of the benchmark binary
+  uint64_t allocations();
+
+  template <typename Operation>
+  Result run(const char* const name, const uint16_t devices, const uint32_t min_ms, Operation operation)
+  {
+    typedef std::chrono::steady_clock Clock;
+
+    // warm up, e.g. first allocations of reused buffers
+    operation();
+
+    uint64_t iterations = 0;
+    const uint64_t allocations_before = allocations();
+    const Clock::time_point start = Clock::now();
+    Clock::duration elapsed;
+
+    do
+    {
+      for (uint32_t i = 0; i < 16; i++)
+        operation();
+
+      iterations += 16;
+      elapsed = Clock::now() - start;
+    }
+    while (elapsed < std::chrono::milliseconds(min_ms));
+
+    Result result;
+    result.name = name;
+    result.devices = devices;
+    result.ns_per_op = double(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / iterations;
+    result.allocs_per_op = double(allocations() - allocations_before) / iterations;
+
+    printf("%-24s %4u devices %14.0f ns/op %10.1f allocs/op\n",
+      result.name.c_str(), result.devices, result.ns_per_op, result.allocs_per_op);
+
+    return result;
+  }
+
+  // one line per result: name, devices, ns/op, allocs/op
+  inline bool save(const char* const path, const std::vector<Result>& results)
+  {
+    FILE* const file = fopen(path, "w");
+
+    if (file == nullptr)
+      return false;
+
+    for (const Result& result : results)
+      fprintf(file, "%s %u %.1f %.2f\n", result.name.c_str(), result.devices, result.ns_per_op, result.allocs_per_op);
+
+    fclose(file);
+    return true;
+  }
+
+  inline bool load(const char* const path, std::vector<Result>& results)
+  {
+    FILE* const file = fopen(path, "r");
+
+    if (file == nullptr)
+      return false;
+
+    char name[64];
+    unsigned devices;
+    Result result;
+
+    while (fscanf(file, "%63s %u %lf %lf", name, &devices, &result.ns_per_op, &result.allocs_per_op) == 4)
+    {
+      result.name = name;
+      result.devices = devices;
+      results.push_back(result);
+    }
+
+    fclose(file);
+    return true;
+  }
+
+  // Print change against the baseline, false if anything got slower than the threshold
+  // or allocates more
+  inline bool compare(
+    const std::vector<Result>& baseline,
+    const std::vector<Result>& results,
+    const double threshold_percent
+  ) {
+    bool passed = true;
+
+    for (const Result& result : results)
+    {
+      for (const Result& base : baseline)
+      {
+        if (base.name != result.name || base.devices != result.devices)
+          continue;
+
+        const double change = base.ns_per_op > 0 ? 100.0 * (result.ns_per_op - base.ns_per_op) / base.ns_per_op : 0;
+        const bool slower = change > threshold_percent;
+        const bool allocates = result.allocs_per_op > base.allocs_per_op + 0.05;
+
+        printf("%-24s %4u devices %+8.1f %% time, allocs/op %.1f -> %.1f%s\n",
+          result.name.c_str(), result.devices, change, base.allocs_per_op, result.allocs_per_op,
+          slower || allocates ? "  REGRESSION" : "");
+
+        passed &= !slower && !allocates;
+      }
+    }
+
+    return passed;
+  }
+};
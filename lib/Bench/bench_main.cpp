@@ -0,0 +1,266 @@
+// Microbenchmarks of the paths running on every cycle: VALUE_UPDATE building and
+// serialization, the MQTT handlers of the firmware, the config hash and register decoding.
+// Every case runs at 1, 16, 64 and 247 devices.
+//
+// Settings are taken from the environment:
+//   BENCH_MIN_MS     minimal run time of every case in ms (default 200)
+//   BENCH_SAVE       path to save the results to as baseline
+//   BENCH_BASELINE   path of the baseline to compare against, regressions fail the run
+//   BENCH_THRESHOLD  time increase in percent counted as regression (default 10)
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <FW_updater.hpp>
+#include <MD5.hpp>
+#include <MQTT_client.hpp>
+#include <Bus_config.hpp>
+#include <Datapoint.hpp>
+#include <MQTT_handlers.hpp>
+#include <Poller.hpp>
+#include <Read_planner.hpp>
+#include "Bench.hpp"
+
+#ifdef __GLIBC__
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* pointer, size_t size);
+
+static std::atomic<uint64_t> allocation_count(0);
+
+// every heap allocation of the binary, operator new included, goes through these
+extern "C" void* malloc(size_t size)
+{
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size)
+{
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* pointer, size_t size)
+{
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  return __libc_realloc(pointer, size);
+}
+
+uint64_t Bench::allocations()
+{
+  return allocation_count.load(std::memory_order_relaxed);
+}
+#else
+uint64_t Bench::allocations()
+{
+  return 0;
+}
+#endif
+
+static const char* const module_mac = "02:00:00:00:00:01";
+static const uint16_t device_counts[] = { 1, 16, 64, 247 };
+
+static double setting(const char* const name, const double fallback)
+{
+  const char* const value = getenv(name);
+  return value != nullptr && *value != '\0' ? atof(value) : fallback;
+}
+
+// poller the handlers hand their commands and configurations to, never started: the
+// benchmarks take them out again
+static Read_planner read_planner(Modbus_RTU::timing(Bus_config::default_baud_rate), H300::response_delay_us);
+static Poller poller(read_planner, 10);
+
+// publish buffers are sized by the benchmarks themselves
+static void reserve_buffers()
+{
+}
+
+static void drain_poller()
+{
+  Command command;
+  Device_config config;
+
+  while (poller.commands.pop(command));
+
+  while (poller.configs.pop(config))
+    delete config.devices;
+}
+
+// register values of a running drive, indexed by datapoint table index
+static void running_drive(uint16_t* const raw)
+{
+  for (uint8_t i = 0; i < Datapoints::count; i++)
+  {
+    const uint16_t register_addr = Datapoints::table[i].register_addr;
+
+    raw[i] = register_addr == H300::get_motion_register ? 1
+      : register_addr == H300::state_register ? 0
+      : register_addr == H300::accel_time_register || register_addr == H300::decel_time_register ? 10
+      : 4998;
+  }
+}
+
+static std::string config_payload(const uint16_t device_count)
+{
+  std::string payload = "{";
+
+  for (uint16_t i = 0; i < device_count; i++)
+    payload += (String(i > 0 ? ", " : "") + "\"vfd" + (i + 1) + "\": {\"address\": " + (i + 1)
+      + ", \"poll_rate\": 1, \"deadbands\": {\"GET_FREQ\": 0.05}}").c_str();
+
+  return payload + "}";
+}
+
+// Values of all devices into the VALUE_UPDATE document, as publish_samples() does
+static void decode_values(
+  JsonDocument& values_json,
+  const std::vector<std::string>& device_ids,
+  const uint16_t* const raw
+) {
+  values_json.clear();
+
+  for (const std::string& device_id : device_ids)
+  {
+    JsonObject device_object = values_json.createNestedObject(device_id.c_str());
+
+    for (uint8_t i = 0; i < Datapoints::count; i++)
+      if (Datapoints::readable_mask() & (1u << i))
+        Datapoints::table[i].decode(raw[i], device_object);
+  }
+}
+
+static void bench_devices(const uint16_t device_count, const uint32_t min_ms, std::vector<Bench::Result>& results)
+{
+  std::vector<std::string> device_ids;
+
+  for (uint16_t i = 0; i < device_count; i++)
+    device_ids.push_back((String("vfd") + (i + 1)).c_str());
+
+  uint16_t raw[Datapoints::count];
+  running_drive(raw);
+
+  // sized as by reserve_publish_buffers() in main.cpp
+  DynamicJsonDocument values_json(
+    JSON_OBJECT_SIZE(device_count) + device_count * (JSON_OBJECT_SIZE(Datapoints::count) + 12)
+  );
+
+  MQTT_client mqtt_client("127.0.0.1", 1883, 1024);
+  FW_updater fw_updater("127.0.0.1", 5000);
+  mqtt_client.setup_mqtt(module_mac, "VFD_H300");
+
+  // the firmware handlers, routed as in setup() of main.cpp
+  MQTT_handlers::connect(&mqtt_client, &fw_updater, module_mac);
+  mqtt_client.reserve_value_update(device_count * 320);
+
+  results.push_back(Bench::run("decode_registers", device_count, min_ms, [&]() {
+    decode_values(values_json, device_ids, raw);
+  }));
+
+  results.push_back(Bench::run("value_update_json", device_count, min_ms, [&]() {
+    decode_values(values_json, device_ids, raw);
+    mqtt_client.publish_value_update(values_json);
+    mqtt_client.flush(UINT32_MAX);
+  }));
+
+  results.push_back(Bench::run("request_result", device_count, min_ms, [&]() {
+    mqtt_client.publish_request_result(7, false, "Error: Modbus queue full");
+    mqtt_client.flush(UINT32_MAX);
+  }));
+
+  // configuration of the case, every other run differs by a trailing space so that it is
+  // applied in full rather than recognized by its hash
+  const String set_config_topic = String(module_mac) + "/SET_CONFIG";
+  const String set_config_payload(config_payload(device_count));
+  const String set_config_changed = set_config_payload + " ";
+  bool config_changed = false;
+
+  results.push_back(Bench::run("resolve_set_config", device_count, min_ms, [&]() {
+    const String& payload = config_changed ? set_config_changed : set_config_payload;
+    config_changed = !config_changed;
+
+    mqtt_client.dispatch(set_config_topic.c_str(), payload.c_str(), payload.length());
+    mqtt_client.flush(UINT32_MAX);
+    drain_poller();
+  }));
+
+  // SET_VALUE to the last device of the configuration applied above
+  const String set_value_topic = String(module_mac) + "/SET_VALUE";
+  const String set_value_payload = String("{\"device_id\": \"") + device_ids.back().c_str()
+    + "\", \"datapoint\": \"SET_FREQ\", \"value\": \"42.5\", \"sequence_number\": 7}";
+
+  results.push_back(Bench::run("resolve_set_value", device_count, min_ms, [&]() {
+    mqtt_client.dispatch(set_value_topic.c_str(), set_value_payload.c_str(), set_value_payload.length());
+    drain_poller();
+  }));
+
+  // as on SET_CONFIG in main.cpp, hashed in place
+  results.push_back(Bench::run("config_hash", device_count, min_ms, [&]() {
+    MD5::Hasher hasher;
+    char digest[MD5::digest_length + 1];
+    hasher.update(set_config_payload.c_str(), set_config_payload.length());
+    hasher.finish_digest(digest);
+  }));
+
+  // MD5 block transform on byte loads (unaligned input) and on word loads (aligned input)
+  std::vector<uint32_t> md5_buffer(set_config_payload.length() / 4 + 2);
+  unsigned char* const md5_words = reinterpret_cast<unsigned char*>(&md5_buffer[0]);
+  memcpy(md5_words + 1, set_config_payload.c_str(), set_config_payload.length());
+
+  results.push_back(Bench::run("md5_bytes", device_count, min_ms, [&]() {
+    MD5::Hasher hasher;
+    unsigned char hash[MD5::hash_length];
+    hasher.update(md5_words + 1, set_config_payload.length());
+    hasher.finish(hash);
+  }));
+
+  memcpy(md5_words, set_config_payload.c_str(), set_config_payload.length());
+
+  results.push_back(Bench::run("md5_words", device_count, min_ms, [&]() {
+    MD5::Hasher hasher;
+    unsigned char hash[MD5::hash_length];
+    hasher.update(md5_words, set_config_payload.length());
+    hasher.finish(hash);
+  }));
+}
+
+int main()
+{
+  const uint32_t min_ms = setting("BENCH_MIN_MS", 200);
+  std::vector<Bench::Result> results;
+
+  for (const Datapoint& datapoint : Datapoints::table)
+    if (datapoint.readable)
+      read_planner.add_register(datapoint.register_addr);
+
+  MQTT_handlers::setup(&poller, reserve_buffers);
+
+  for (const uint16_t device_count : device_counts)
+    bench_devices(device_count, min_ms, results);
+
+  const char* const save_path = getenv("BENCH_SAVE");
+  const char* const baseline_path = getenv("BENCH_BASELINE");
+
+  if (save_path != nullptr && !Bench::save(save_path, results))
+  {
+    printf("Cannot save results to %s\n", save_path);
+    return 2;
+  }
+
+  if (baseline_path == nullptr)
+    return 0;
+
+  std::vector<Bench::Result> baseline;
+
+  if (!Bench::load(baseline_path, baseline))
+  {
+    printf("Cannot read baseline %s\n", baseline_path);
+    return 2;
+  }
+
+  printf("\nCompared to %s:\n", baseline_path);
+  return Bench::compare(baseline, results, setting("BENCH_THRESHOLD", 10)) ? 0 : 1;
+}
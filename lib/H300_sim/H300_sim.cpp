@@ -0,0 +1,330 @@
+#include "H300_sim.hpp"
+#include <H300.hpp>
+
+// GET_MOTION values
+static constexpr uint16_t motion_forward = 1;
+static constexpr uint16_t motion_reverse = 2;
+
+H300_sim::H300_sim(
+  const uint8_t unit_count,
+  const unsigned long baud_rate,
+  const Faults& faults,
+  const Modbus_RTU::Parity parity,
+  const uint32_t seed
+) : line_timing(Modbus_RTU::timing(baud_rate, parity)), faults(faults), random(seed), response_ready_us(0),
+    requests(0), broadcasts(0), responses(0), exceptions(0), timeouts(0), crc_errors(0)
+{
+  Unit unit = {};
+  unit.online = true;
+  unit.motion = H300::motion_stopped;
+  unit.updated_us = micros();
+  unit.set_freq = max_freq;
+  unit.accel_time = 10;
+  unit.decel_time = 10;
+
+  units.assign(unit_count < max_units ? unit_count : max_units, unit);
+}
+
+void H300_sim::set_online(const uint8_t unit_id, const bool online)
+{
+  if (unit_id >= 1 && unit_id <= units.size())
+    units[unit_id - 1].online = online;
+}
+
+// Counters since the previous call, safe to call from another thread than the bus
+H300_sim::Stats H300_sim::take_stats()
+{
+  Stats stats;
+  stats.requests = requests.exchange(0);
+  stats.broadcasts = broadcasts.exchange(0);
+  stats.responses = responses.exchange(0);
+  stats.exceptions = exceptions.exchange(0);
+  stats.timeouts = timeouts.exchange(0);
+  stats.crc_errors = crc_errors.exchange(0);
+
+  return stats;
+}
+
+// Response becomes readable once it would have been received over the line
+int H300_sim::available()
+{
+  if (response.empty() || int32_t(micros() - response_ready_us) < 0)
+    return 0;
+
+  return response.size();
+}
+
+int H300_sim::read()
+{
+  if (available() == 0)
+    return -1;
+
+  const uint8_t byte = response.front();
+  response.pop_front();
+  return byte;
+}
+
+// Whole request frame from the master, a new request drops any unread response
+size_t H300_sim::write(const uint8_t* const buffer, const size_t size)
+{
+  response.clear();
+
+  std::vector<uint8_t> reply;
+  execute(buffer, size, reply);
+
+  if (reply.empty())
+    return size;
+
+  if (chance(faults.timeout_rate))
+  {
+    timeouts++;
+    return size;
+  }
+
+  const uint16_t crc = crc16(reply.data(), reply.size());
+  reply.push_back(crc & 0xFF);
+  reply.push_back(crc >> 8);
+
+  if (chance(faults.crc_error_rate))
+  {
+    reply.back() ^= 0x01;
+    crc_errors++;
+  }
+
+  const uint32_t jitter_us = faults.jitter_us > 0 ? random() % (faults.jitter_us + 1) : 0;
+
+  response.assign(reply.begin(), reply.end());
+  response_ready_us = micros() + (size + reply.size()) * line_timing.char_us + faults.latency_us + jitter_us;
+  responses++;
+
+  return size;
+}
+
+// Execute the request on the addressed unit, reply stays empty if nobody answers
+void H300_sim::execute(const uint8_t* const request, const size_t size, std::vector<uint8_t>& reply)
+{
+  // frames with a broken CRC are ignored by the drives
+  if (size < 8 || crc16(request, size - 2) != (request[size - 2] | (request[size - 1] << 8)))
+    return;
+
+  const uint8_t unit_id = request[0];
+  const uint8_t function = request[1];
+  const uint16_t start = (request[2] << 8) | request[3];
+  const uint16_t count = (request[4] << 8) | request[5];
+  const uint32_t now_us = micros();
+
+  requests++;
+
+  if (unit_id == Modbus_RTU::broadcast_address)
+  {
+    broadcasts++;
+
+    // broadcast writes are executed by every drive, none of them answers
+    for (Unit& unit : units)
+    {
+      if (!unit.online)
+        continue;
+
+      update(unit, now_us);
+
+      if (function == Modbus_RTU::write_single_register_function)
+        write_register(unit, start, count);
+      else if (function == Modbus_RTU::write_multiple_registers_function)
+        for (uint16_t i = 0; i < count && 9u + 2u * i < size; i++)
+          write_register(unit, start + i, (request[7 + 2 * i] << 8) | request[8 + 2 * i]);
+    }
+
+    return;
+  }
+
+  if (unit_id > units.size() || !units[unit_id - 1].online)
+    return;
+
+  Unit& unit = units[unit_id - 1];
+  update(unit, now_us);
+
+  reply.push_back(unit_id);
+  reply.push_back(function);
+
+  uint8_t result = Modbus_RTU::success;
+
+  switch (function)
+  {
+    case Modbus_RTU::read_holding_registers_function:
+      if (count == 0 || count > 125)
+      {
+        result = Modbus_RTU::illegal_data_value;
+        break;
+      }
+
+      reply.push_back(2 * count);
+
+      for (uint16_t i = 0; i < count; i++)
+      {
+        const uint16_t value = read_register(unit, start + i);
+        reply.push_back(value >> 8);
+        reply.push_back(value & 0xFF);
+      }
+      break;
+
+    case Modbus_RTU::write_single_register_function:
+      result = write_register(unit, start, count);
+
+      // response is an echo of the request
+      if (result == Modbus_RTU::success)
+        reply.insert(reply.end(), request + 2, request + 6);
+      break;
+
+    case Modbus_RTU::write_multiple_registers_function:
+      if (count == 0 || size != 9u + 2 * count || request[6] != 2 * count)
+      {
+        result = Modbus_RTU::illegal_data_value;
+        break;
+      }
+
+      for (uint16_t i = 0; i < count && result == Modbus_RTU::success; i++)
+        result = write_register(unit, start + i, (request[7 + 2 * i] << 8) | request[8 + 2 * i]);
+
+      if (result == Modbus_RTU::success)
+        reply.insert(reply.end(), request + 2, request + 6);
+      break;
+
+    default:
+      result = Modbus_RTU::illegal_function;
+      break;
+  }
+
+  if (result != Modbus_RTU::success)
+  {
+    reply.resize(1);
+    reply.push_back(function | 0x80);
+    reply.push_back(result);
+    exceptions++;
+  }
+}
+
+// Advance the output frequency ramp and the timer of the drive
+void H300_sim::update(Unit& unit, const uint32_t now_us)
+{
+  const float elapsed_s = (now_us - unit.updated_us) / 1000000.0f;
+  unit.updated_us = now_us;
+
+  const bool running = unit.motion == motion_forward || unit.motion == motion_reverse;
+
+  if (running && unit.set_timer > 0 && millis() - unit.timer_since_ms >= unit.set_timer * 6000u)
+    unit.motion = H300::motion_stopped;
+
+  const float target = unit.motion == H300::motion_stopped ? 0 : unit.set_freq;
+
+  // ramp times are given for the full 0 to max_freq range
+  if (unit.freq < target)
+    unit.freq = fminf(target, unit.freq + elapsed_s * max_freq / (unit.accel_time > 0 ? unit.accel_time : 1));
+  else
+    unit.freq = fmaxf(target, unit.freq - elapsed_s * max_freq / (unit.decel_time > 0 ? unit.decel_time : 1));
+}
+
+// Registers outside of H300.hpp read as zero, like the unused ones of a group do
+uint16_t H300_sim::read_register(Unit& unit, const uint16_t register_addr)
+{
+  switch (register_addr)
+  {
+    case H300::speed_register:
+      return unit.speed;
+    case H300::state_register:
+      return unit.state;
+    case H300::get_freq_register:
+      return uint16_t(unit.freq + 0.5f);
+    case H300::set_freq_register:
+      return unit.set_freq;
+    case H300::get_motion_register:
+      return unit.motion;
+    case H300::accel_time_register:
+      return unit.accel_time;
+    case H300::decel_time_register:
+      return unit.decel_time;
+    case H300::set_timer_register:
+      return unit.set_timer;
+    case H300::get_timer_register:
+    {
+      if (unit.motion == H300::motion_stopped || unit.set_timer == 0)
+        return 0;
+
+      // minutes with single decimal
+      const uint32_t elapsed = (millis() - unit.timer_since_ms) / 6000;
+      return elapsed < unit.set_timer ? unit.set_timer - elapsed : 0;
+    }
+    default:
+      return 0;
+  }
+}
+
+uint8_t H300_sim::write_register(Unit& unit, const uint16_t register_addr, const uint16_t value)
+{
+  switch (register_addr)
+  {
+    case H300::speed_register:
+      unit.speed = value;
+      return Modbus_RTU::success;
+    case H300::set_freq_register:
+      if (value > max_freq)
+        return Modbus_RTU::illegal_data_value;
+
+      unit.set_freq = value;
+      return Modbus_RTU::success;
+    case H300::accel_time_register:
+      unit.accel_time = value;
+      return Modbus_RTU::success;
+    case H300::decel_time_register:
+      unit.decel_time = value;
+      return Modbus_RTU::success;
+    case H300::set_timer_register:
+      unit.set_timer = value;
+      return Modbus_RTU::success;
+    case H300::set_motion_register:
+      // SET_MOTION labels: FWD, REV, FWD_JOG, REV_JOG, STOP, BREAK
+      switch (value)
+      {
+        case 1:
+        case 3:
+          unit.motion = motion_forward;
+          unit.timer_since_ms = millis();
+          return Modbus_RTU::success;
+        case 2:
+        case 4:
+          unit.motion = motion_reverse;
+          unit.timer_since_ms = millis();
+          return Modbus_RTU::success;
+        case 5:
+          unit.motion = H300::motion_stopped;
+          return Modbus_RTU::success;
+        case H300::motion_break:
+          unit.motion = H300::motion_stopped;
+          unit.freq = 0;
+          return Modbus_RTU::success;
+        default:
+          return Modbus_RTU::illegal_data_value;
+      }
+    default:
+      return Modbus_RTU::illegal_data_address;
+  }
+}
+
+bool H300_sim::chance(const float rate)
+{
+  return rate > 0 && std::uniform_real_distribution<float>(0, 1)(random) < rate;
+}
+
+uint16_t H300_sim::crc16(const uint8_t* const data, const size_t length)
+{
+  uint16_t crc = 0xFFFF;
+
+  for (size_t i = 0; i < length; i++)
+  {
+    crc ^= data[i];
+
+    for (uint8_t bit = 0; bit < 8; bit++)
+      crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+  }
+
+  return crc;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <Arduino.h>
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <random>
+#include <vector>
+#include <Modbus_RTU.hpp>
+
+// Fleet of simulated H300 drives sharing one RS-485 bus, attached to a UART of the
+// native core in place of the MAX485 transceiver. Drives implement the registers of
+// H300.hpp, run up and down after SET_MOTION and answer after the configured latency.
+// Timeouts and CRC errors are injected at the given rates.
+class H300_sim : public Stream
+{
+  public:
+    static constexpr uint8_t max_units = 247;
+    static constexpr uint16_t max_freq = 5000;   // 50.00 Hz, SET_FREQ of a fresh drive
+
+    struct Faults
+    {
+      uint32_t latency_us;        // from the end of the request to the start of the response
+      uint32_t jitter_us;         // random extra latency, 0 to jitter_us
+      float timeout_rate;         // share of requests left unanswered
+      float crc_error_rate;       // share of responses with broken CRC
+    };
+
+    struct Stats
+    {
+      uint32_t requests;
+      uint32_t broadcasts;
+      uint32_t responses;
+      uint32_t exceptions;
+      uint32_t timeouts;
+      uint32_t crc_errors;
+    };
+
+    // units 1 to unit_count answer on the bus
+    H300_sim(
+      const uint8_t unit_count,
+      const unsigned long baud_rate,
+      const Faults& faults,
+      const Modbus_RTU::Parity parity = Modbus_RTU::Parity::NONE,
+      const uint32_t seed = 1
+    );
+
+    // unit which is switched off never answers
+    void set_online(const uint8_t unit_id, const bool online);
+    Stats take_stats();
+
+    int available() override;
+    int read() override;
+    size_t write(const uint8_t* const buffer, const size_t size) override;
+
+  private:
+    struct Unit
+    {
+      bool online;
+      uint16_t motion;        // GET_MOTION value
+      float freq;             // output frequency in 0.01 Hz
+      uint32_t updated_us;
+      uint32_t timer_since_ms;
+      uint16_t state;
+      uint16_t speed;
+      uint16_t set_freq;
+      uint16_t accel_time;
+      uint16_t decel_time;
+      uint16_t set_timer;
+    };
+
+    const Modbus_RTU::Timing line_timing;
+    const Faults faults;
+    std::vector<Unit> units;
+    std::mt19937 random;
+
+    std::deque<uint8_t> response;
+    uint32_t response_ready_us;
+
+    std::atomic<uint32_t> requests;
+    std::atomic<uint32_t> broadcasts;
+    std::atomic<uint32_t> responses;
+    std::atomic<uint32_t> exceptions;
+    std::atomic<uint32_t> timeouts;
+    std::atomic<uint32_t> crc_errors;
+
+    void execute(const uint8_t* const request, const size_t size, std::vector<uint8_t>& reply);
+    void update(Unit& unit, const uint32_t now_us);
+    uint16_t read_register(Unit& unit, const uint16_t register_addr);
+    uint8_t write_register(Unit& unit, const uint16_t register_addr, const uint16_t value);
+    bool chance(const float rate);
+
+    static uint16_t crc16(const uint8_t* const data, const size_t length);
+};
@@ -0,0 +1,190 @@
+// Entry point of the native environment: runs the firmware setup() and loop() against
+// simulated H300 drives and the in-process broker, reporting bus and publish throughput.
+//
+// Settings are taken from the environment:
+//   SIM_UNITS           drives in total, spread over the buses (default 16, at most 247 per bus)
+//   SIM_BUSES           1 or 2 (default 1)
+//   SIM_BAUD            baud rate of every bus (default 19200)
+//   SIM_POLL_RATE       poll interval of every drive in seconds (default 1)
+//   SIM_LATENCY_US      response latency of the drives (default 5000)
+//   SIM_JITTER_US       random extra latency (default 0)
+//   SIM_TIMEOUT_RATE    share of requests left unanswered, 0 to 1 (default 0)
+//   SIM_CRC_ERROR_RATE  share of responses with broken CRC, 0 to 1 (default 0)
+//   SIM_DURATION        seconds to run, 0 runs until killed (default 0)
+//   SIM_VERBOSE         1 prints the firmware log and every published message (default 0)
+//
+// Lines "<topic> <payload>" on stdin are delivered to the module like gateway messages,
+// a topic without "/" other than ALL_MODULES is prefixed with the module MAC.
+
+// unit tests of the native environment bring their own entry point
+#ifndef PIO_UNIT_TESTING
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <MQTT.h>
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <Bus_config.hpp>
+#include "H300_sim.hpp"
+
+static const char* const value_update_topic = "VALUE_UPDATE";
+
+static double setting(const char* const name, const double fallback)
+{
+  const char* const value = getenv(name);
+  return value != nullptr && *value != '\0' ? atof(value) : fallback;
+}
+
+// Console output of the firmware when it is not wanted
+class Null_stream : public Stream
+{
+  public:
+    int available() override { return 0; }
+    int read() override { return -1; }
+    size_t write(const uint8_t* const, const size_t size) override { return size; }
+};
+
+static std::atomic<uint32_t> value_updates(0);
+static std::atomic<uint32_t> value_update_bytes(0);
+static std::atomic<uint32_t> other_messages(0);
+
+// SET_CONFIG with the drives spread over the buses round robin
+static std::string fleet_config(
+  const uint16_t unit_count,
+  const uint8_t bus_count,
+  const unsigned long baud_rate,
+  const double poll_rate
+) {
+  std::string config = "{\"buses\": [";
+
+  for (uint8_t bus = 0; bus < bus_count; bus++)
+  {
+    // bus 0 on UART2, bus 1 on UART1
+    config += String(bus > 0 ? ", " : "").c_str();
+    config += (String("{\"uart\": ") + (bus == 0 ? 2 : 1) + ", \"rx_pin\": " + (bus == 0 ? -1 : 4)
+      + ", \"tx_pin\": " + (bus == 0 ? -1 : 5) + ", \"baud_rate\": " + baud_rate + "}").c_str();
+  }
+
+  config += "]";
+
+  for (uint16_t i = 0; i < unit_count; i++)
+  {
+    config += (String(", \"vfd") + (i + 1) + "\": {\"address\": " + (i / bus_count + 1)
+      + ", \"bus\": " + (i % bus_count) + ", \"poll_rate\": " + poll_rate + "}").c_str();
+  }
+
+  return config + "}";
+}
+
+static void read_gateway_messages(const std::string module_mac)
+{
+  std::string line;
+
+  while (std::getline(std::cin, line))
+  {
+    const size_t separator = line.find(' ');
+
+    if (separator == std::string::npos)
+      continue;
+
+    std::string topic = line.substr(0, separator);
+
+    if (topic.find('/') == std::string::npos && topic != "ALL_MODULES")
+      topic = module_mac + "/" + topic;
+
+    Local_broker::instance().inject(topic, line.substr(separator + 1));
+  }
+}
+
+int main()
+{
+  const uint8_t bus_count = setting("SIM_BUSES", 1) > 1 ? 2 : 1;
+  const uint16_t max_units = bus_count * H300_sim::max_units;
+  const uint16_t unit_count = setting("SIM_UNITS", 16) < max_units ? setting("SIM_UNITS", 16) : max_units;
+  const unsigned long baud_rate = setting("SIM_BAUD", Bus_config::default_baud_rate);
+  const uint32_t duration_s = setting("SIM_DURATION", 0);
+  const bool verbose = setting("SIM_VERBOSE", 0) != 0;
+
+  H300_sim::Faults faults;
+  faults.latency_us = setting("SIM_LATENCY_US", 5000);
+  faults.jitter_us = setting("SIM_JITTER_US", 0);
+  faults.timeout_rate = setting("SIM_TIMEOUT_RATE", 0);
+  faults.crc_error_rate = setting("SIM_CRC_ERROR_RATE", 0);
+
+  H300_sim* buses[Bus_config::max_buses] = {};
+  HardwareSerial* const uarts[Bus_config::max_buses] = { &Serial2, &Serial1 };
+
+  for (uint8_t bus = 0; bus < bus_count; bus++)
+  {
+    // drives with index bus, bus + bus_count, ...
+    const uint8_t bus_units = (unit_count + bus_count - 1 - bus) / bus_count;
+    buses[bus] = new H300_sim(bus_units, baud_rate, faults, Modbus_RTU::Parity::NONE, bus + 1);
+    uarts[bus]->attach(buses[bus]);
+  }
+
+  Null_stream console_sink;
+  if (!verbose)
+    Serial.attach(&console_sink);
+
+  Local_broker::instance().listen([verbose](const std::string& topic, const std::string& payload) {
+    if (topic == value_update_topic)
+    {
+      value_updates++;
+      value_update_bytes += payload.size();
+    }
+    else
+      other_messages++;
+
+    if (verbose || topic != value_update_topic)
+      printf("<< %s %s\n", topic.c_str(), payload.c_str());
+  });
+
+  const std::string module_mac = WiFi.macAddress().c_str();
+
+  printf("Simulating %u drives on %u bus(es) at %lu baud, latency %u us, timeouts %.3f, CRC errors %.3f\n",
+    unit_count, bus_count, baud_rate, faults.latency_us, faults.timeout_rate, faults.crc_error_rate);
+  printf("Module MAC %s, messages from stdin as \"<topic> <payload>\"\n", module_mac.c_str());
+
+  Local_broker::instance().inject(
+    module_mac + "/SET_CONFIG",
+    fleet_config(unit_count, bus_count, baud_rate, setting("SIM_POLL_RATE", 1))
+  );
+
+  std::thread(read_gateway_messages, module_mac).detach();
+
+  setup();
+
+  const uint32_t started_ms = millis();
+  uint32_t reported_ms = started_ms;
+
+  while (duration_s == 0 || millis() - started_ms < duration_s * 1000)
+  {
+    loop();
+
+    const uint32_t now = millis();
+
+    if (now - reported_ms < 1000)
+      continue;
+
+    for (uint8_t bus = 0; bus < bus_count; bus++)
+    {
+      const H300_sim::Stats stats = buses[bus]->take_stats();
+
+      printf("[%6.1f s] bus %u: %u requests, %u responses, %u exceptions, %u timeouts, %u CRC errors\n",
+        (now - started_ms) / 1000.0, bus, stats.requests, stats.responses, stats.exceptions,
+        stats.timeouts, stats.crc_errors);
+    }
+
+    printf("[%6.1f s] published %u VALUE_UPDATE (%u bytes), %u other messages\n",
+      (now - started_ms) / 1000.0, value_updates.exchange(0), value_update_bytes.exchange(0),
+      other_messages.exchange(0));
+
+    reported_ms = now;
+  }
+
+  return 0;
+}
+
+#endif
@@ -1,16 +1,48 @@
 #include "MD5.hpp"
 
-char* MD5::make_digest(const unsigned char *digest, int len) /* {{{ */
+MD5::Hasher::Hasher()
+{
+	MD5Init(&context);
+}
+
+void MD5::Hasher::update(const void *data, size_t size)
+{
+	MD5Update(&context, data, size);
+}
+
+/* hash_length bytes */
+void MD5::Hasher::finish(unsigned char *hash)
+{
+	MD5Final(hash, &context);
+}
+
+/* digest_length hex characters and the terminator */
+void MD5::Hasher::finish_digest(char *digest)
+{
+	unsigned char hash[hash_length];
+
+	MD5Final(hash, &context);
+	write_digest(hash, hash_length, digest);
+}
+
+/* len * 2 hex characters and the terminator */
+void MD5::write_digest(const unsigned char *hash, size_t len, char *digest)
 {
-	char * md5str = (char*) malloc(sizeof(char)*(len*2+1));
 	static const char hexits[17] = "0123456789abcdef";
-	int i;
+	size_t i;
 
 	for (i = 0; i < len; i++) {
-		md5str[i * 2]       = hexits[digest[i] >> 4];
-		md5str[(i * 2) + 1] = hexits[digest[i] &  0x0F];
+		digest[i * 2]       = hexits[hash[i] >> 4];
+		digest[(i * 2) + 1] = hexits[hash[i] &  0x0F];
 	}
-	md5str[len * 2] = '\0';
+	digest[len * 2] = '\0';
+}
+
+char* MD5::make_digest(const unsigned char *digest, int len) /* {{{ */
+{
+	char * md5str = (char*) malloc(sizeof(char)*(len*2+1));
+
+	write_digest(digest, len, md5str);
 	return md5str;
 }
 
@@ -39,25 +71,28 @@ char* MD5::make_digest(const unsigned char *digest, int len) /* {{{ */
  * SET reads 4 input bytes in little-endian byte order and stores them
  * in a properly aligned word in host byte order.
  *
- * The check for little-endian architectures that tolerate unaligned
- * memory accesses is just an optimization.  Nothing will break if it
- * doesn't work.
+ * On little-endian targets an aligned input word already is in host byte
+ * order, so WORDS reads it directly.  Unaligned reads are never made as
+ * Xtensa faults on them, such input takes the byte path.
  */
-#if defined(__i386__) || defined(__x86_64__) || defined(__vax__)
-# define SET(n) \
-	(*(MD5_u32plus *)&ptr[(n) * 4])
-# define GET(n) \
-	SET(n)
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+# define MD5_LITTLE_ENDIAN 1
 #else
-# define SET(n) \
+# define MD5_LITTLE_ENDIAN 0
+#endif
+
+#define SET(n) \
+	(WORDS ? words[(n)] : \
 	(ctx->block[(n)] = \
 	(MD5_u32plus)ptr[(n) * 4] | \
 	((MD5_u32plus)ptr[(n) * 4 + 1] << 8) | \
 	((MD5_u32plus)ptr[(n) * 4 + 2] << 16) | \
-	((MD5_u32plus)ptr[(n) * 4 + 3] << 24))
-# define GET(n) \
-	(ctx->block[(n)])
-#endif
+	((MD5_u32plus)ptr[(n) * 4 + 3] << 24)))
+#define GET(n) \
+	(WORDS ? words[(n)] : ctx->block[(n)])
+
+template <bool WORDS>
+static const void *transform(MD5_CTX *ctx, const void *data, size_t size);
 
 /*
  * This processes one or more 64-byte data blocks, but does NOT update
@@ -66,11 +101,23 @@ char* MD5::make_digest(const unsigned char *digest, int len) /* {{{ */
 const void *MD5::body(void *ctxBuf, const void *data, size_t size)
 {
 	MD5_CTX *ctx = (MD5_CTX*)ctxBuf;
+
+	if (MD5_LITTLE_ENDIAN && ((uintptr_t)data & 3) == 0)
+		return transform<true>(ctx, data, size);
+
+	return transform<false>(ctx, data, size);
+}
+
+template <bool WORDS>
+static const void *transform(MD5_CTX *ctx, const void *data, size_t size)
+{
 	const unsigned char *ptr;
+	const MD5_u32plus *words;
 	MD5_u32plus a, b, c, d;
 	MD5_u32plus saved_a, saved_b, saved_c, saved_d;
 
-	ptr = (unsigned char*)data;
+	ptr = (const unsigned char*)data;
+	words = (const MD5_u32plus*)data;
 
 	a = ctx->a;
 	b = ctx->b;
@@ -163,6 +210,7 @@ const void *MD5::body(void *ctxBuf, const void *data, size_t size)
 		d += saved_d;
 
 		ptr += 64;
+		words += 16;
 	} while (size -= 64);
 
 	ctx->a = a;
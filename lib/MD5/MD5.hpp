@@ -24,9 +24,11 @@
  * <scott@macvicar.net>
  */
 
+#include <stdint.h>
 #include <string.h>
 
-typedef unsigned long MD5_u32plus;
+// exactly 32 bits, the little-endian fast path reads input words through this type
+typedef uint32_t MD5_u32plus;
 
 typedef struct {
 	MD5_u32plus lo, hi;
@@ -37,9 +39,34 @@ typedef struct {
 
 namespace MD5
 {
+	constexpr size_t hash_length = 16;
+	constexpr size_t digest_length = 2 * hash_length;	// hex characters without the terminator
+
+	/*
+	 * Incremental hashing over caller provided data, nothing is copied
+	 * or allocated. Data may be fed in any number of pieces.
+	 */
+	class Hasher
+	{
+		public:
+			Hasher();
+			void update(const void *data, size_t size);
+			void finish(unsigned char *hash);
+			void finish_digest(char *digest);
+
+		private:
+			MD5_CTX context;
+	};
+
+	void write_digest(const unsigned char *hash, size_t len, char *digest);
+
+	/*
+	 * Allocating helpers, the caller has to free() the result.
+	 */
 	unsigned char* make_hash(char *arg);
 	unsigned char* make_hash(char *arg,size_t size);
 	char* make_digest(const unsigned char *digest, int len);
+
  	const void *body(void *ctxBuf, const void *data, size_t size);
 	void MD5Init(void *ctxBuf);
 	void MD5Final(unsigned char *result, void *ctxBuf);
@@ -1,17 +1,68 @@
 #include "MQTT_client.hpp"
+#include <Msgpack_writer.hpp>
+
+static constexpr const char* value_update_topic = "VALUE_UPDATE";
+static constexpr const char* stats_topic = "STATS";
+static constexpr const char* encoding_names[] = { "json", "msgpack" };
+
+// Length of the string serialized as JSON, including quotes and escapes
+static size_t json_string_size(const char* str)
+{
+  size_t size = 2;
+
+  for (; *str; str++)
+    size += (*str == '"' || *str == '\\' || uint8_t(*str) < 0x20) ? 6 : 1;
+
+  return size;
+}
+
+static size_t write_json_string(char* const buffer, const char* str)
+{
+  size_t length = 0;
+  buffer[length++] = '"';
+
+  for (; *str; str++)
+  {
+    if (*str == '"' || *str == '\\' || uint8_t(*str) < 0x20)
+      length += sprintf(buffer + length, "\\u%04x", uint8_t(*str));
+    else
+      buffer[length++] = *str;
+  }
+
+  buffer[length++] = '"';
+  return length;
+}
 
 MQTT_client::MQTT_client(const char* gw_ip, const uint32_t port, const uint16_t buffer_size) 
-  : MQTTClient(buffer_size)
+  : MQTTClient(buffer_size), buffer_size(buffer_size)
 {
+  // without the queue messages are published right away
+  queue_buffer = (char*) malloc(queue_slots * buffer_size);
+
+  // STATS does not depend on the device count, so it has a buffer of its own rather than
+  // the VALUE_UPDATE one, which is sized for the devices and may be too small for it
+  stats_buffer_size = max_payload_size(stats_topic);
+  stats_buffer = (char*) malloc(stats_buffer_size);
+
   begin(gw_ip, port, wifi_client);
   setOptions(5, true, 1000);
 }
 
-void MQTT_client::setup_mqtt(
-  const std::string& module_mac, 
-  const std::string& module_type, 
-  MQTTClientCallbackSimple callback
-) {
+// FNV-1a of the topic, its length on the way
+static uint32_t topic_hash(const char* const topic, size_t* const length)
+{
+  uint32_t state = 2166136261u;
+  size_t i = 0;
+
+  for (; topic[i] != '\0'; i++)
+    state = (state ^ uint8_t(topic[i])) * 16777619u;
+
+  *length = i;
+  return state;
+}
+
+void MQTT_client::setup_mqtt(const std::string& module_mac, const std::string& module_type)
+{
   this->module_mac = module_mac;
   this->module_type = module_type;
   
@@ -20,25 +71,74 @@ void MQTT_client::setup_mqtt(
   json["module_mac"] = module_mac;
   serializeJson(json, lw_msg);
 
-  onMessage(callback);
+  // topic and payload as received, the simple callback would copy both into Strings
+  onMessageAdvanced(message_received);
   setWill("MODULE_DISCONNECT", lw_msg, false, 2);
 
   while (!connect(module_mac.c_str(), false)) 
     delay(1000);
 }
 
+// Subscribe to the topic and hand its messages to the handler
+bool MQTT_client::route(const char* const topic, Handler handler, const uint8_t QOS)
+{
+  if (route_count == max_routes)
+    return false;
+
+  size_t length;
+  Route& route = routes[route_count++];
+  route.hash = topic_hash(topic, &length);
+  route.topic = topic;
+  route.handler = handler;
+
+  return subscribe(topic, QOS);
+}
+
+// Hand the message to the handler of its topic, false if the topic is not routed.
+// Topics are told apart by their hash, the whole topic is compared only on a match.
+bool MQTT_client::dispatch(const char* const topic, const char* const payload, const size_t length) const
+{
+  size_t topic_length;
+  const uint32_t hash = topic_hash(topic, &topic_length);
+
+  for (uint8_t i = 0; i < route_count; i++)
+  {
+    const Route& route = routes[i];
+
+    if (route.hash != hash || route.topic.size() != topic_length || memcmp(route.topic.data(), topic, topic_length) != 0)
+      continue;
+
+    route.handler(payload, length);
+    return true;
+  }
+
+  return false;
+}
+
+void MQTT_client::message_received(MQTTClient* client, char topic[], char bytes[], int length)
+{
+  static_cast<MQTT_client*>(client)->dispatch(topic, bytes != nullptr ? bytes : "", length);
+}
+
 bool MQTT_client::publish_module_id(const uint8_t QOS) 
 {
   char msg[256];
-  StaticJsonDocument<JSON_OBJECT_SIZE(2) + 256> json;
+  StaticJsonDocument<JSON_OBJECT_SIZE(4) + JSON_ARRAY_SIZE(2) + 256> json;
   json["module_mac"] = module_mac;
   json["module_type"] = module_type;
+
+  // always JSON, the gateway picks one of the offered encodings by REQUEST set_encoding
+  JsonArray encodings = json.createNestedArray("encodings");
+  for (const char* const name : encoding_names)
+    encodings.add(name);
+  json["encoding"] = encoding_name(encoding);
+
   serializeJson(json, msg);
 
-  return publish("MODULE_ID", msg, false, QOS);
+  return send("MODULE_ID", msg, strlen(msg), QOS, Priority::URGENT);
 }
 
-bool MQTT_client::publish_config_update(const std::string& config_hash, const uint8_t QOS) 
+bool MQTT_client::publish_config_update(const char* const config_hash, const uint8_t QOS) 
 {
   char msg[256];
   StaticJsonDocument<JSON_OBJECT_SIZE(2) + 256> json;
@@ -46,42 +146,423 @@ bool MQTT_client::publish_config_update(const std::string& config_hash, const ui
   json["config_hash"] = config_hash;
   serializeJson(json, msg);
 
-  return publish("MODULE_CONFIG_UPDATE", msg, false, QOS);
+  return send("MODULE_CONFIG_UPDATE", msg, strlen(msg), QOS, Priority::URGENT);
 }
 
-bool MQTT_client::publish_value_update(DynamicJsonDocument values_json, const uint8_t QOS) 
+// Largest payload of a publish packet on the topic which fits the client buffer
+size_t MQTT_client::max_payload_size(const char* const topic) const
 {
-  char msg[256];
-  DynamicJsonDocument json(512);
-  json["module_mac"] = module_mac;
-  json["values"] = values_json;
-  serializeJson(json, msg);
+  // fixed header, topic length and packet identifier
+  const size_t overhead = 5 + 2 + strlen(topic) + 2;
+
+  return buffer_size > overhead ? buffer_size - overhead : 0;
+}
+
+// Allocate serialization buffer for VALUE_UPDATE, expected to be called when device count changes
+bool MQTT_client::reserve_value_update(const size_t values_size)
+{
+  // {"module_mac":"...","values":{...}}
+  const size_t envelope_size = 32 + module_mac.size();
+  const size_t max_size = max_payload_size(value_update_topic);
+  const size_t size = values_size + envelope_size < max_size ? values_size + envelope_size : max_size;
+
+  if (size == value_buffer_size)
+    return true;
+
+  char* const buffer = (char*) realloc(value_buffer, size);
+
+  if (buffer == nullptr)
+    return false;
+
+  value_buffer = buffer;
+  value_buffer_size = size;
+  return true;
+}
+
+bool MQTT_client::publish_value_update(const JsonDocument& values_json, const uint8_t QOS, const Priority priority)
+{
+  if (value_buffer == nullptr && !reserve_value_update(max_payload_size(value_update_topic)))
+    return false;
+
+  return publish_split(
+    value_update_topic, "values", values_json.as<JsonObjectConst>(), QOS, priority, value_buffer, value_buffer_size
+  );
+}
+
+// Serialize entries straight into the preallocated buffer, one by one. Whenever the
+// next entry does not fit, the message is closed, published and a new one started.
+bool MQTT_client::publish_split(
+  const char* const topic,
+  const char* const key,
+  JsonObjectConst entries,
+  const uint8_t QOS,
+  const Priority priority,
+  char* const buffer,
+  const size_t capacity
+) {
+  const size_t prefix_length = snprintf(
+    buffer, capacity, "{\"module_mac\":\"%s\",\"%s\":{", module_mac.c_str(), key
+  );
+  // closing braces of the values and of the message
+  const size_t suffix_length = 2;
+
+  if (prefix_length + suffix_length >= capacity)
+    return false;
+
+  size_t length = prefix_length;
+  bool result = true;
+
+  for (const JsonPairConst device : entries)
+  {
+    const size_t device_size = json_string_size(device.key().c_str()) + 1 + measureJson(device.value());
+    const size_t separator = length > prefix_length ? 1 : 0;
+
+    if (length + separator + device_size + suffix_length >= capacity)
+    {
+      if (prefix_length + device_size + suffix_length >= capacity)
+      {
+        oversize_count++;
+        result = false;
+        continue;
+      }
+
+      result &= publish_chunk(topic, buffer, length, QOS, priority);
+      length = prefix_length;
+    }
+
+    if (length > prefix_length)
+      buffer[length++] = ',';
+
+    length += write_json_string(buffer + length, device.key().c_str());
+    buffer[length++] = ':';
+    length += serializeJson(device.value(), buffer + length, capacity - length);
+  }
+
+  if (length > prefix_length)
+    result &= publish_chunk(topic, buffer, length, QOS, priority);
+
+  return result;
+}
+
+bool MQTT_client::publish_chunk(
+  const char* const topic,
+  char* const buffer,
+  size_t length,
+  const uint8_t QOS,
+  const Priority priority
+) {
+  buffer[length++] = '}';
+  buffer[length++] = '}';
+
+  return send(topic, buffer, length, QOS, priority);
+}
+
+// MessagePack VALUE_UPDATE from already encoded device entries (device id followed by
+// its values map), split into several messages the same way as the JSON one
+bool MQTT_client::publish_value_update(
+  const uint8_t* const entries,
+  const uint16_t* const entry_sizes,
+  const size_t entry_count,
+  const uint8_t QOS,
+  const Priority priority
+) {
+  if (value_buffer == nullptr && !reserve_value_update(max_payload_size(value_update_topic)))
+    return false;
+
+  uint8_t* const buffer = reinterpret_cast<uint8_t*>(value_buffer);
+
+  // {"module_mac": "...", "values": {...}}
+  Msgpack_writer writer(buffer, value_buffer_size);
+  writer.write_map(2);
+  writer.write_str("module_mac");
+  writer.write_str(module_mac.c_str(), module_mac.size());
+  writer.write_str("values");
+  const size_t values_map = writer.begin_map();
+
+  if (writer.overflow())
+    return false;
+
+  const size_t prefix_length = writer.written();
+  size_t length = prefix_length;
+  uint16_t chunk_entries = 0;
+  const uint8_t* entry = entries;
+  bool result = true;
 
-  return publish("VALUE_UPDATE", msg, false, QOS);
+  for (size_t i = 0; i < entry_count; entry += entry_sizes[i], i++)
+  {
+    if (length + entry_sizes[i] > value_buffer_size)
+    {
+      if (prefix_length + entry_sizes[i] > value_buffer_size)
+      {
+        oversize_count++;
+        result = false;
+        continue;
+      }
+
+      writer.end_map(values_map, chunk_entries);
+      result &= send(value_update_topic, value_buffer, length, QOS, priority);
+      length = prefix_length;
+      chunk_entries = 0;
+    }
+
+    memcpy(buffer + length, entry, entry_sizes[i]);
+    length += entry_sizes[i];
+    chunk_entries++;
+  }
+
+  if (chunk_entries > 0)
+  {
+    writer.end_map(values_map, chunk_entries);
+    result &= send(value_update_topic, value_buffer, length, QOS, priority);
+  }
+
+  return result;
 }
 
 bool MQTT_client::publish_request_result(
   const uint16_t sequence_number,
   const bool result,
-  const std::string& details,
+  const char* const details,
+  const uint32_t latency_us,
   const uint8_t QOS
 ) {
-  char msg[256];
-  DynamicJsonDocument json(512);
-  json["module_mac"] = module_mac;
+  // strings are linked, not copied
+  StaticJsonDocument<JSON_OBJECT_SIZE(5)> json;
+  json["module_mac"] = module_mac.c_str();
   json["sequence_number"] = sequence_number;
   json["result"] = result ? "OK" : "ERROR";
 
-  if (!details.empty() && !result)
+  if (details != nullptr && *details != '\0' && !result)
     json["details"] = details;
-  
-  serializeJson(json, msg);
 
-  return publish("REQUEST_RESULT", msg, false, QOS);
+  if (latency_us > 0)
+    json["latency_ms"] = latency_us / 1000.0;
+
+  return publish_document("REQUEST_RESULT", json, QOS);
+}
+
+// Module and bus stats in the first message, device stats split over as many as needed.
+// Always JSON, the stats are meant for monitoring rather than the gateway.
+bool MQTT_client::publish_stats(const JsonDocument& module_json, const JsonDocument& devices_json, const uint8_t QOS)
+{
+  if (stats_buffer == nullptr)
+    return false;
+
+  size_t length = snprintf(
+    stats_buffer, stats_buffer_size, "{\"module_mac\":\"%s\",\"module\":", module_mac.c_str()
+  );
+
+  if (length + measureJson(module_json) + 1 >= stats_buffer_size)
+  {
+    oversize_count++;
+    return false;
+  }
+
+  length += serializeJson(module_json, stats_buffer + length, stats_buffer_size - length);
+  stats_buffer[length++] = '}';
+
+  bool result = send(stats_topic, stats_buffer, length, QOS, Priority::TELEMETRY);
+
+  if (devices_json.size() > 0)
+    result &= publish_split(
+      stats_topic, "devices", devices_json.as<JsonObjectConst>(), QOS, Priority::TELEMETRY, stats_buffer, stats_buffer_size
+    );
+
+  return result;
+}
+
+// Publish the message right away if nothing is queued ahead of it, otherwise queue
+// it for flush(), a copy of the payload is kept in its slot
+bool MQTT_client::send(
+  const char* const topic,
+  const char* const payload,
+  const size_t length,
+  const uint8_t QOS,
+  const Priority priority
+) {
+  if (queue_buffer == nullptr || (queue_count == 0 && connected()))
+  {
+    if (publish(topic, payload, length, false, QOS))
+    {
+      stalled = false;
+      return true;
+    }
+
+    publish_failures++;
+
+    // without the queue the message is lost, otherwise it waits in the queue for flush()
+    if (queue_buffer == nullptr)
+      return false;
+
+    stalled = true;
+  }
+
+  // would not fit the client buffer either
+  if (length > buffer_size)
+  {
+    publish_failures++;
+    return false;
+  }
+
+  // full queue is worked off right away while the broker keeps up, messages are dropped
+  // only once a publish failed, until flush() gets through again
+  if (queue_count == queue_slots && !stalled)
+    stalled = !publish_next();
+
+  const int8_t slot = free_slot();
+
+  if (slot < 0)
+  {
+    queue_drops++;
+    return false;
+  }
+
+  Outbound& message = queue[slot];
+
+  if (!message.used)
+    queue_count++;
+
+  message.topic = topic;
+  message.length = length;
+  message.QOS = QOS;
+  message.priority = priority;
+  message.order = queue_order++;
+  message.used = true;
+  memcpy(queue_buffer + slot * buffer_size, payload, length);
+
+  return true;
+}
+
+// Slot for a new message. When the queue is full the oldest telemetry gives way, urgent
+// messages are never dropped, -1 if only those are queued. VALUE_UPDATE chunks hold other
+// devices or deltas than the newer message, so dropping one flags its values as lost.
+int8_t MQTT_client::free_slot()
+{
+  int8_t oldest = -1;
+
+  for (uint8_t i = 0; i < queue_slots; i++)
+  {
+    const Outbound& message = queue[i];
+
+    if (!message.used)
+      return i;
+
+    if (message.priority != Priority::TELEMETRY)
+      continue;
+
+    if (oldest < 0 || int32_t(message.order - queue[oldest].order) < 0)
+      oldest = i;
+  }
+
+  if (oldest < 0)
+    return -1;
+
+  queue_drops++;
+
+  if (queue[oldest].topic == value_update_topic)
+    values_lost = true;
+
+  return oldest;
+}
+
+// Publish queued messages until the queue is empty or the budget is used up. A failed
+// publish ends the flush, as the broker does not keep up or the connection is lost.
+bool MQTT_client::flush(const uint32_t budget_us)
+{
+  const uint32_t started_us = micros();
+
+  while (queue_count > 0)
+  {
+    stalled = !publish_next();
+
+    if (stalled)
+      return false;
+
+    if (micros() - started_us >= budget_us)
+      break;
+  }
+
+  return true;
+}
+
+// Publish the first queued message, urgent ones first and otherwise oldest first.
+// Urgent messages stay in their slot after a failed publish and are retried by the
+// next flush(), telemetry leaves the queue either way.
+bool MQTT_client::publish_next()
+{
+  int8_t next = -1;
+
+  for (uint8_t i = 0; i < queue_slots; i++)
+  {
+    const Outbound& message = queue[i];
+
+    if (!message.used)
+      continue;
+
+    if (next < 0 || message.priority > queue[next].priority
+      || (message.priority == queue[next].priority && int32_t(message.order - queue[next].order) < 0))
+      next = i;
+  }
+
+  if (next < 0)
+    return true;
+
+  Outbound& message = queue[next];
+  const bool published = publish(message.topic, queue_buffer + next * buffer_size, message.length, false, message.QOS);
+
+  if (!published)
+    publish_failures++;
+
+  if (!published && message.priority == Priority::URGENT)
+    return false;
+
+  message.used = false;
+  queue_count--;
+
+  if (!published && message.topic == value_update_topic)
+    values_lost = true;
+
+  return published;
+}
+
+// Serialize the document in the negotiated encoding and publish it
+bool MQTT_client::publish_document(const char* const topic, const JsonDocument& json, const uint8_t QOS)
+{
+  char msg[256];
+  const size_t length = encoding == Encoding::MSGPACK
+    ? serializeMsgPack(json, msg, sizeof(msg))
+    : serializeJson(json, msg, sizeof(msg));
+
+  return send(topic, msg, length, QOS, Priority::URGENT);
+}
+
+bool MQTT_client::parse_encoding(const char* const name, Encoding* const encoding)
+{
+  if (name == nullptr)
+    return false;
+
+  for (uint8_t i = 0; i < sizeof(encoding_names) / sizeof(encoding_names[0]); i++)
+  {
+    if (strcmp(name, encoding_names[i]) == 0)
+    {
+      *encoding = static_cast<Encoding>(i);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+const char* MQTT_client::encoding_name(const Encoding encoding)
+{
+  return encoding_names[static_cast<uint8_t>(encoding)];
 }
 
 MQTT_client::~MQTT_client() 
 {
   disconnect();
+  free(value_buffer);
+  free(stats_buffer);
+  free(queue_buffer);
 }
 
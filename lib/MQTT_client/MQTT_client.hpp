@@ -10,27 +10,142 @@
 class MQTT_client : public MQTTClient 
 {
   public:
+    // encoding of VALUE_UPDATE and REQUEST_RESULT, negotiated by the gateway
+    enum class Encoding : uint8_t
+    {
+      JSON,
+      MSGPACK
+    };
+
+    // order in which queued messages are published
+    enum class Priority : uint8_t
+    {
+      TELEMETRY,  // dropped, oldest first, when the queue is full
+      URGENT      // request results, module messages and alarms, never dropped, retried until published
+    };
+
+    // handler of an inbound topic, the payload is NUL terminated
+    typedef void (*Handler)(const char* const payload, const size_t length);
+
+    static constexpr uint8_t max_routes = 8;
+    static constexpr uint8_t queue_slots = 8;
+
     MQTT_client(const char* gw_ip, const uint32_t port = 1883, const uint16_t buffer_size = 256);
 
-    void setup_mqtt(
-      const std::string& module_mac, 
-      const std::string& module_type, 
-      MQTTClientCallbackSimple callback
-    );
+    void setup_mqtt(const std::string& module_mac, const std::string& module_type);
+    bool route(const char* const topic, Handler handler, const uint8_t QOS = 0);
+    bool dispatch(const char* const topic, const char* const payload, const size_t length) const;
     bool publish_module_id(const uint8_t QOS = 2);
-    bool publish_config_update(const std::string& config_hash, const uint8_t QOS = 2);
-    bool publish_value_update(DynamicJsonDocument values_json, const uint8_t QOS = 0);
+    bool publish_config_update(const char* const config_hash, const uint8_t QOS = 2);
+    bool reserve_value_update(const size_t values_size);
+    bool publish_value_update(
+      const JsonDocument& values_json,
+      const uint8_t QOS = 0,
+      const Priority priority = Priority::TELEMETRY
+    );
+    bool publish_value_update(
+      const uint8_t* const entries,
+      const uint16_t* const entry_sizes,
+      const size_t entry_count,
+      const uint8_t QOS = 0,
+      const Priority priority = Priority::TELEMETRY
+    );
     bool publish_request_result(
       const uint16_t sequence_number, 
       const bool result, 
-      const std::string& details = "",
+      const char* const details = nullptr,
+      const uint32_t latency_us = 0,
       const uint8_t QOS = 1
     );
+    bool publish_stats(const JsonDocument& module_json, const JsonDocument& devices_json, const uint8_t QOS = 0);
+    bool flush(const uint32_t budget_us);
 
     ~MQTT_client();
 
+    static bool parse_encoding(const char* const name, Encoding* const encoding);
+    static const char* encoding_name(const Encoding encoding);
+
+    Encoding encoding = Encoding::JSON;
+
+    // devices which did not fit into a single message even on their own
+    uint32_t oversize_count = 0;
+
+    // messages the client failed to publish, e.g. while disconnected
+    uint32_t publish_failures = 0;
+
+    // messages dropped from the full outbound queue or refused by it
+    uint32_t queue_drops = 0;
+
+    // a VALUE_UPDATE was dropped or its publish failed after it was queued, the devices
+    // in it have to be reported again, reset by the caller
+    bool values_lost = false;
+
   private:
+    // subscribed topic, hashed once when it is routed
+    struct Route
+    {
+      uint32_t hash;
+      std::string topic;
+      Handler handler;
+    };
+
+    // message waiting in the outbound queue, its payload is in the slot of queue_buffer
+    struct Outbound
+    {
+      const char* topic;  // string literal, all topics published are constants
+      uint16_t length;
+      uint8_t QOS;
+      Priority priority;
+      uint32_t order;
+      bool used;
+    };
+
+    Route routes[max_routes];
+    uint8_t route_count = 0;
+
+    Outbound queue[queue_slots] = {};
+    char* queue_buffer = nullptr;  // buffer_size bytes per slot, allocated once
+    uint8_t queue_count = 0;
+    uint32_t queue_order = 0;
+    bool stalled = false;  // last publish failed, a full queue drops telemetry
+
     std::string module_mac;
     std::string module_type;
     WiFiClient wifi_client;
+
+    const uint16_t buffer_size;
+    char* value_buffer = nullptr;
+    size_t value_buffer_size = 0;
+    char* stats_buffer = nullptr;  // largest STATS payload, allocated once
+    size_t stats_buffer_size = 0;
+
+    size_t max_payload_size(const char* const topic) const;
+    bool publish_split(
+      const char* const topic,
+      const char* const key,
+      JsonObjectConst entries,
+      const uint8_t QOS,
+      const Priority priority,
+      char* const buffer,
+      const size_t capacity
+    );
+    bool publish_chunk(
+      const char* const topic,
+      char* const buffer,
+      size_t length,
+      const uint8_t QOS,
+      const Priority priority
+    );
+    bool send(
+      const char* const topic,
+      const char* const payload,
+      const size_t length,
+      const uint8_t QOS,
+      const Priority priority
+    );
+    bool publish_document(const char* const topic, const JsonDocument& json, const uint8_t QOS);
+    int8_t free_slot();
+    bool publish_next();
+
+    static void message_received(MQTTClient* client, char topic[], char bytes[], int length);
 };
\ No newline at end of file
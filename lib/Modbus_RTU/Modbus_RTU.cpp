@@ -0,0 +1,409 @@
+#include "Modbus_RTU.hpp"
+
+Modbus_RTU::Modbus_RTU(
+  Stream& serial,
+  const unsigned long baud_rate,
+  const uint8_t de_pin,
+  const uint8_t re_neg_pin,
+  const uint32_t response_timeout_ms,
+  const Parity parity
+) : serial(serial), de_pin(de_pin), re_neg_pin(re_neg_pin),
+    response_timeout_us(response_timeout_ms * 1000), line_timing(timing(baud_rate, parity)),
+    // the transmitter is released one character after the frame has been handed to the UART
+    turnaround_us(line_timing.char_us), quiet_us(line_timing.silence_us), state(State::IDLE), state_since_us(0),
+    last_activity_us(micros()), transmit_us(0), request_since_us(0), latency_stats(),
+    queue_head(0), queue_count(0), frame_length(0), expected_length(0)
+{
+  pinMode(re_neg_pin, OUTPUT);
+  pinMode(de_pin, OUTPUT);
+
+  // Init in receive mode
+  digitalWrite(re_neg_pin, 0);
+  digitalWrite(de_pin, 0);
+}
+
+bool Modbus_RTU::read_holding_registers(
+  const uint8_t unit_id,
+  const uint16_t start,
+  const uint8_t count,
+  Callback callback,
+  void* const context,
+  const uint32_t tag,
+  const uint32_t first_byte_timeout_us
+) {
+  if (count == 0 || count > max_registers)
+    return false;
+
+  Transaction* const transaction = enqueue(
+    unit_id, read_holding_registers_function, start, count, callback, context, tag
+  );
+
+  if (transaction == nullptr)
+    return false;
+
+  transaction->first_byte_timeout_us = first_byte_timeout_us;
+  return true;
+}
+
+bool Modbus_RTU::write_single_register(
+  const uint8_t unit_id,
+  const uint16_t register_addr,
+  const uint16_t value,
+  Callback callback,
+  void* const context,
+  const uint32_t tag
+) {
+  return enqueue(unit_id, write_single_register_function, register_addr, value, callback, context, tag) != nullptr;
+}
+
+// Write consecutive registers in one frame, the values are copied
+bool Modbus_RTU::write_multiple_registers(
+  const uint8_t unit_id,
+  const uint16_t start,
+  const uint8_t count,
+  const uint16_t* const values,
+  Callback callback,
+  void* const context,
+  const uint32_t tag
+) {
+  if (count == 0 || count > max_registers)
+    return false;
+
+  Transaction* const transaction = enqueue(
+    unit_id, write_multiple_registers_function, start, count, callback, context, tag
+  );
+
+  if (transaction == nullptr)
+    return false;
+
+  memcpy(transaction->values, values, count * sizeof(values[0]));
+  return true;
+}
+
+Modbus_RTU::Transaction* Modbus_RTU::enqueue(
+  const uint8_t unit_id,
+  const uint8_t function,
+  const uint16_t start,
+  const uint16_t count,
+  Callback callback,
+  void* const context,
+  const uint32_t tag
+) {
+  if (queue_count == queue_size)
+    return nullptr;
+
+  uint8_t position = queue_count;
+
+  // writes overtake reads waiting in the queue, the transaction on the bus is left alone
+  if (function != read_holding_registers_function)
+  {
+    const uint8_t first = state == State::IDLE ? 0 : 1;
+
+    for (position = first; position < queue_count; position++)
+      if (queue[(queue_head + position) % queue_size].function == read_holding_registers_function)
+        break;
+
+    for (uint8_t i = queue_count; i > position; i--)
+      queue[(queue_head + i) % queue_size] = queue[(queue_head + i - 1) % queue_size];
+  }
+
+  Transaction& transaction = queue[(queue_head + position) % queue_size];
+  transaction.unit_id = unit_id;
+  transaction.function = function;
+  transaction.start = start;
+  transaction.count = count;
+  transaction.callback = callback;
+  transaction.context = context;
+  transaction.tag = tag;
+  transaction.first_byte_timeout_us = 0;
+  transaction.result = success;
+  transaction.latency_us = 0;
+  transaction.first_byte_us = 0;
+
+  queue_count++;
+  return &transaction;
+}
+
+// Advance the transaction at the head of the queue, never blocks
+void Modbus_RTU::poll()
+{
+  if (queue_count == 0)
+    return;
+
+  Transaction& transaction = queue[queue_head];
+  const uint32_t now = micros();
+
+  switch (state)
+  {
+    case State::IDLE:
+      // keep the bus silent between frames
+      if (now - last_activity_us >= quiet_us)
+        transmit(transaction);
+      break;
+
+    case State::TRANSMITTING:
+      if (now - state_since_us < transmit_us)
+        break;
+
+      // frame has left the UART by now, flush only makes sure of it
+      serial.flush();
+      digitalWrite(re_neg_pin, 0);
+      digitalWrite(de_pin, 0);
+
+      frame_length = 0;
+      state = State::WAITING_RESPONSE;
+      state_since_us = last_activity_us = micros();
+
+      // nobody responds to a broadcast, the units get time to execute it instead
+      if (transaction.unit_id == broadcast_address)
+      {
+        transaction.latency_us = micros() - request_since_us;
+        complete(transaction, success);
+        quiet_us = broadcast_turnaround_us;
+      }
+      break;
+
+    case State::WAITING_RESPONSE:
+      receive(transaction);
+      break;
+  }
+}
+
+void Modbus_RTU::transmit(Transaction& transaction)
+{
+  // drop any late response of a previous transaction
+  while (serial.available())
+    serial.read();
+
+  frame[0] = transaction.unit_id;
+  frame[1] = transaction.function;
+  frame[2] = transaction.start >> 8;
+  frame[3] = transaction.start & 0xFF;
+  frame[4] = transaction.count >> 8;
+  frame[5] = transaction.count & 0xFF;
+
+  frame_length = 6;
+
+  if (transaction.function == write_multiple_registers_function)
+  {
+    frame[frame_length++] = 2 * transaction.count;
+
+    for (uint8_t i = 0; i < transaction.count; i++)
+    {
+      frame[frame_length++] = transaction.values[i] >> 8;
+      frame[frame_length++] = transaction.values[i] & 0xFF;
+    }
+  }
+
+  const uint16_t crc = crc16(frame, frame_length);
+  frame[frame_length++] = crc & 0xFF;
+  frame[frame_length++] = crc >> 8;
+
+  // write single register response is an echo of the request,
+  // write multiple registers response echoes its first 6 bytes
+  expected_length = transaction.function == read_holding_registers_function
+    ? 5 + 2 * transaction.count
+    : 8;
+
+  digitalWrite(re_neg_pin, 1);
+  digitalWrite(de_pin, 1);
+  serial.write(frame, frame_length);
+
+  // the UART sends the frame on its own, direction is switched back once it is out
+  transmit_us = frame_length * line_timing.char_us + turnaround_us;
+  state = State::TRANSMITTING;
+  state_since_us = request_since_us = micros();
+}
+
+void Modbus_RTU::receive(Transaction& transaction)
+{
+  while (serial.available() && frame_length < sizeof(frame))
+  {
+    frame[frame_length++] = serial.read();
+    last_activity_us = micros();
+
+    if (frame_length == 1)
+      transaction.first_byte_us = last_activity_us - state_since_us;
+
+    // exception response has fixed length
+    if (frame_length == 2 && (frame[1] & 0x80))
+      expected_length = 5;
+  }
+
+  uint8_t result;
+
+  const uint32_t waiting_us = micros() - state_since_us;
+
+  // a silent unit is given up early, a response on its way gets the full timeout
+  if (frame_length >= expected_length)
+    result = parse(transaction);
+  else if (waiting_us >= response_timeout_us
+    || (frame_length == 0 && transaction.first_byte_timeout_us > 0 && waiting_us >= transaction.first_byte_timeout_us))
+    result = response_timed_out;
+  else
+    return;
+
+  transaction.latency_us = micros() - request_since_us;
+
+  latency_stats.transactions++;
+  latency_stats.total_us += transaction.latency_us;
+
+  if (transaction.latency_us > latency_stats.max_us)
+    latency_stats.max_us = transaction.latency_us;
+
+  complete(transaction, result);
+}
+
+uint8_t Modbus_RTU::parse(Transaction& transaction) const
+{
+  const uint16_t crc = frame[expected_length - 2] | (frame[expected_length - 1] << 8);
+
+  if (crc16(frame, expected_length - 2) != crc)
+    return invalid_crc;
+
+  if (frame[0] != transaction.unit_id)
+    return invalid_slave_id;
+
+  if ((frame[1] & 0x7F) != transaction.function)
+    return invalid_function;
+
+  if (frame[1] & 0x80)
+    return frame[2];
+
+  if (transaction.function == read_holding_registers_function)
+  {
+    if (frame[2] != 2 * transaction.count)
+      return invalid_function;
+
+    for (uint8_t i = 0; i < transaction.count; i++)
+      transaction.values[i] = (frame[3 + 2 * i] << 8) | frame[4 + 2 * i];
+
+    return success;
+  }
+
+  // a write is confirmed only by the echo of its address and value (0x06) or quantity (0x10)
+  if (((frame[2] << 8) | frame[3]) != transaction.start || ((frame[4] << 8) | frame[5]) != transaction.count)
+    return invalid_function;
+
+  return success;
+}
+
+void Modbus_RTU::complete(Transaction& transaction, const uint8_t result)
+{
+  transaction.result = result;
+
+  state = State::IDLE;
+  last_activity_us = micros();
+  quiet_us = line_timing.silence_us;
+
+  // dequeue before the callback so that it can queue further requests
+  const Transaction finished = transaction;
+  queue_head = (queue_head + 1) % queue_size;
+  queue_count--;
+
+  if (finished.callback)
+    finished.callback(finished.context, finished);
+}
+
+bool Modbus_RTU::idle() const
+{
+  return queue_count == 0;
+}
+
+// True while a write is queued or on the bus
+bool Modbus_RTU::writes_pending() const
+{
+  for (uint8_t i = 0; i < queue_count; i++)
+    if (queue[(queue_head + i) % queue_size].function != read_holding_registers_function)
+      return true;
+
+  return false;
+}
+
+// Drop pending requests of the context, transaction on the bus is finished without callback
+void Modbus_RTU::cancel(void* const context)
+{
+  uint8_t kept = 0;
+
+  for (uint8_t i = 0; i < queue_count; i++)
+  {
+    Transaction& transaction = queue[(queue_head + i) % queue_size];
+    const bool in_flight = i == 0 && state != State::IDLE;
+
+    if (transaction.context == context && !in_flight)
+      continue;
+
+    if (transaction.context == context)
+      transaction.callback = nullptr;
+
+    if (kept != i)
+      queue[(queue_head + kept) % queue_size] = transaction;
+
+    kept++;
+  }
+
+  queue_count = kept;
+}
+
+void Modbus_RTU::cancel_all()
+{
+  if (queue_count == 0)
+    return;
+
+  if (state == State::IDLE)
+  {
+    queue_count = 0;
+    return;
+  }
+
+  queue[queue_head].callback = nullptr;
+  queue_count = 1;
+}
+
+// Finish all queued transactions with the given result, e.g. before the bus is deleted
+void Modbus_RTU::abort(const uint8_t result)
+{
+  digitalWrite(re_neg_pin, 0);
+  digitalWrite(de_pin, 0);
+
+  while (queue_count > 0)
+    complete(queue[queue_head], result);
+}
+
+// Latency of the transactions finished since the previous call
+Modbus_RTU::Latency_stats Modbus_RTU::take_latency_stats()
+{
+  const Latency_stats taken = latency_stats;
+  latency_stats = Latency_stats();
+
+  return taken;
+}
+
+Modbus_RTU::Timing Modbus_RTU::timing(const unsigned long baud_rate, const Parity parity)
+{
+  // start bit + 8 data bits + parity bit + stop bit
+  const uint32_t bits_per_char = parity == Parity::NONE ? 10 : 11;
+  Timing line_timing;
+
+  line_timing.char_us = (bits_per_char * 1000000UL + baud_rate - 1) / baud_rate;
+
+  // silent interval of 3.5 characters, fixed above 19200 baud by the spec
+  line_timing.silence_us = baud_rate > 19200 ? 1750 : (line_timing.char_us * 7) / 2;
+
+  return line_timing;
+}
+
+uint16_t Modbus_RTU::crc16(const uint8_t* const data, const uint8_t length)
+{
+  uint16_t crc = 0xFFFF;
+
+  for (uint8_t i = 0; i < length; i++)
+  {
+    crc ^= data[i];
+
+    for (uint8_t bit = 0; bit < 8; bit++)
+      crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+  }
+
+  return crc;
+}
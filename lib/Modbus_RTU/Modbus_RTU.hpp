@@ -0,0 +1,171 @@
+#pragma once
+
+#include <Arduino.h>
+#include <stdint.h>
+
+// Non-blocking Modbus-RTU master. Requests are queued and the transaction
+// (send, wait for response, parse) is advanced by poll(), which is expected
+// to be called from every loop() iteration. Writes are queued ahead of reads
+// which are not on the bus yet. Completion is reported through a callback,
+// result codes match the ModbusMaster library.
+class Modbus_RTU
+{
+  public:
+    static constexpr uint8_t success = 0x00;
+    static constexpr uint8_t illegal_function = 0x01;
+    static constexpr uint8_t illegal_data_address = 0x02;
+    static constexpr uint8_t illegal_data_value = 0x03;
+    static constexpr uint8_t slave_device_failure = 0x04;
+    static constexpr uint8_t invalid_slave_id = 0xE0;
+    static constexpr uint8_t invalid_function = 0xE1;
+    static constexpr uint8_t response_timed_out = 0xE2;
+    static constexpr uint8_t invalid_crc = 0xE3;
+
+    static constexpr uint8_t read_holding_registers_function = 0x03;
+    static constexpr uint8_t write_single_register_function = 0x06;
+    static constexpr uint8_t write_multiple_registers_function = 0x10;
+
+    // writes to the broadcast address are executed by all units without a response
+    static constexpr uint8_t broadcast_address = 0;
+    // highest unit address, the ones above are reserved
+    static constexpr uint8_t max_unit_address = 247;
+    static constexpr uint32_t broadcast_turnaround_us = 100000;
+
+    static constexpr uint8_t max_registers = 64;
+    static constexpr uint8_t queue_size = 16;
+    static constexpr uint32_t default_response_timeout_ms = 2000;
+
+    enum class Parity : uint8_t
+    {
+      NONE,
+      EVEN,
+      ODD
+    };
+
+    // durations on the line derived from its settings
+    struct Timing
+    {
+      uint32_t char_us;
+      uint32_t silence_us;  // t3.5, minimal gap between frames
+    };
+
+    struct Latency_stats
+    {
+      uint32_t transactions;
+      uint32_t total_us;
+      uint32_t max_us;
+    };
+
+    struct Transaction;
+    typedef void (*Callback)(void* context, const Transaction& transaction);
+
+    struct Transaction
+    {
+      uint8_t unit_id;
+      uint8_t function;
+      uint16_t start;
+      uint16_t count;   // register count, written value of write single register
+      Callback callback;
+      void* context;
+      uint32_t tag;
+      uint32_t first_byte_timeout_us;  // times out early if the unit stays silent so long, 0 never
+
+      uint8_t result;
+      uint32_t latency_us;  // from start of the request to the end of the response
+      uint32_t first_byte_us;  // from the end of the request to the first byte of the response
+      uint16_t values[max_registers];   // read values, written values of write multiple registers
+    };
+
+    Modbus_RTU(
+      Stream& serial,
+      const unsigned long baud_rate,
+      const uint8_t de_pin,
+      const uint8_t re_neg_pin,
+      const uint32_t response_timeout_ms = default_response_timeout_ms,
+      const Parity parity = Parity::NONE
+    );
+
+    bool read_holding_registers(
+      const uint8_t unit_id,
+      const uint16_t start,
+      const uint8_t count,
+      Callback callback,
+      void* const context = nullptr,
+      const uint32_t tag = 0,
+      const uint32_t first_byte_timeout_us = 0
+    );
+    bool write_single_register(
+      const uint8_t unit_id,
+      const uint16_t register_addr,
+      const uint16_t value,
+      Callback callback,
+      void* const context = nullptr,
+      const uint32_t tag = 0
+    );
+    bool write_multiple_registers(
+      const uint8_t unit_id,
+      const uint16_t start,
+      const uint8_t count,
+      const uint16_t* const values,
+      Callback callback,
+      void* const context = nullptr,
+      const uint32_t tag = 0
+    );
+
+    void poll();
+    bool idle() const;
+    bool writes_pending() const;
+    void cancel(void* const context);
+    void cancel_all();
+    void abort(const uint8_t result);
+    Latency_stats take_latency_stats();
+
+    static Timing timing(const unsigned long baud_rate, const Parity parity = Parity::NONE);
+
+  private:
+    enum class State : uint8_t
+    {
+      IDLE,
+      TRANSMITTING,
+      WAITING_RESPONSE
+    };
+
+    Stream& serial;
+    const uint8_t de_pin;
+    const uint8_t re_neg_pin;
+    const uint32_t response_timeout_us;
+    const Timing line_timing;
+    const uint32_t turnaround_us;
+    uint32_t quiet_us;  // silence kept after the previous transaction
+
+    State state;
+    uint32_t state_since_us;
+    uint32_t last_activity_us;
+    uint32_t transmit_us;
+    uint32_t request_since_us;
+    Latency_stats latency_stats;
+
+    Transaction queue[queue_size];
+    uint8_t queue_head;
+    uint8_t queue_count;
+
+    uint8_t frame[9 + 2 * max_registers];
+    uint8_t frame_length;
+    uint8_t expected_length;
+
+    Transaction* enqueue(
+      const uint8_t unit_id,
+      const uint8_t function,
+      const uint16_t start,
+      const uint16_t count,
+      Callback callback,
+      void* const context,
+      const uint32_t tag
+    );
+    void transmit(Transaction& transaction);
+    void receive(Transaction& transaction);
+    void complete(Transaction& transaction, const uint8_t result);
+    uint8_t parse(Transaction& transaction) const;
+
+    static uint16_t crc16(const uint8_t* const data, const uint8_t length);
+};
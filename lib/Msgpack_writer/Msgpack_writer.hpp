@@ -0,0 +1,140 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Minimal MessagePack encoder writing into a caller provided buffer.
+// Integer map keys are not supported by ArduinoJson, hence this writer.
+// Once the buffer is exhausted further writes are ignored and overflow() is set.
+class Msgpack_writer
+{
+  public:
+    Msgpack_writer(uint8_t* const buffer, const size_t size)
+      : buffer(buffer), size(size), length(0), overflowed(false) {}
+
+    void write_nil()
+    {
+      put(0xC0);
+    }
+
+    void write_bool(const bool value)
+    {
+      put(value ? 0xC3 : 0xC2);
+    }
+
+    // smallest encoding of the value: positive fixint, uint8, uint16 or uint32
+    void write_uint(const uint32_t value)
+    {
+      if (value < 0x80)
+        put(value);
+      else if (value <= 0xFF)
+      {
+        put(0xCC);
+        put(value);
+      }
+      else if (value <= 0xFFFF)
+      {
+        put(0xCD);
+        put_be(value, 2);
+      }
+      else
+      {
+        put(0xCE);
+        put_be(value, 4);
+      }
+    }
+
+    void write_str(const char* const str)
+    {
+      write_str(str, strlen(str));
+    }
+
+    void write_str(const char* const str, const size_t str_length)
+    {
+      if (str_length < 32)
+        put(0xA0 | str_length);
+      else if (str_length <= 0xFF)
+      {
+        put(0xD9);
+        put(str_length);
+      }
+      else
+      {
+        put(0xDA);
+        put_be(str_length, 2);
+      }
+
+      put(reinterpret_cast<const uint8_t*>(str), str_length);
+    }
+
+    void write_map(const uint16_t count)
+    {
+      if (count < 16)
+        put(0x80 | count);
+      else
+      {
+        put(0xDE);
+        put_be(count, 2);
+      }
+    }
+
+    // map header of yet unknown size, returns position for end_map()
+    size_t begin_map()
+    {
+      const size_t position = length;
+      put(0xDE);
+      put_be(0, 2);
+      return position;
+    }
+
+    void end_map(const size_t position, const uint16_t count)
+    {
+      if (position + 3 > length)
+        return;
+
+      buffer[position + 1] = count >> 8;
+      buffer[position + 2] = count & 0xFF;
+    }
+
+    // already encoded MessagePack data
+    void write_raw(const uint8_t* const data, const size_t data_length)
+    {
+      put(data, data_length);
+    }
+
+    size_t written() const { return length; }
+    bool overflow() const { return overflowed; }
+
+  private:
+    uint8_t* const buffer;
+    const size_t size;
+    size_t length;
+    bool overflowed;
+
+    void put(const uint8_t byte)
+    {
+      if (length < size)
+        buffer[length++] = byte;
+      else
+        overflowed = true;
+    }
+
+    void put(const uint8_t* const data, const size_t data_length)
+    {
+      if (length + data_length > size)
+      {
+        overflowed = true;
+        return;
+      }
+
+      memcpy(buffer + length, data, data_length);
+      length += data_length;
+    }
+
+    void put_be(const uint32_t value, const uint8_t bytes)
+    {
+      for (uint8_t i = bytes; i > 0; i--)
+        put(value >> (8 * (i - 1)));
+    }
+};
@@ -0,0 +1,183 @@
+#include "Arduino.h"
+#include <stdarg.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+HardwareSerial Serial(0);
+HardwareSerial Serial1(1);
+HardwareSerial Serial2(2);
+EspClass ESP;
+
+static std::chrono::steady_clock::time_point start_time()
+{
+  static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  return start;
+}
+
+// wraps around like on the ESP32
+uint32_t micros()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - start_time()
+  ).count();
+}
+
+uint32_t millis()
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now() - start_time()
+  ).count();
+}
+
+void delay(const uint32_t ms)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(const uint32_t us)
+{
+  std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void HardwareSerial::begin(const unsigned long baud_rate, const uint32_t, const int8_t, const int8_t)
+{
+  this->baud_rate = baud_rate;
+}
+
+void HardwareSerial::end()
+{
+  baud_rate = 0;
+}
+
+void HardwareSerial::attach(Stream* const transport)
+{
+  this->transport = transport;
+}
+
+int HardwareSerial::available()
+{
+  return transport != nullptr ? transport->available() : 0;
+}
+
+int HardwareSerial::read()
+{
+  return transport != nullptr ? transport->read() : -1;
+}
+
+size_t HardwareSerial::write(const uint8_t* const buffer, const size_t size)
+{
+  if (transport != nullptr)
+    return transport->write(buffer, size);
+
+  return fwrite(buffer, 1, size, stdout);
+}
+
+void HardwareSerial::flush()
+{
+  if (transport != nullptr)
+    transport->flush();
+  else
+    fflush(stdout);
+}
+
+size_t HardwareSerial::print(const char* const str)
+{
+  return write(reinterpret_cast<const uint8_t*>(str), strlen(str));
+}
+
+size_t HardwareSerial::println(const char* const str)
+{
+  return print(str) + print("\n");
+}
+
+size_t HardwareSerial::printf(const char* const format, ...)
+{
+  char buffer[512];
+  va_list arguments;
+
+  va_start(arguments, format);
+  const int length = vsnprintf(buffer, sizeof(buffer), format, arguments);
+  va_end(arguments);
+
+  if (length <= 0)
+    return 0;
+
+  return write(reinterpret_cast<const uint8_t*>(buffer), size_t(length) < sizeof(buffer) ? length : sizeof(buffer) - 1);
+}
+
+// FreeRTOS task running on its own thread, notifications counted as by xTaskNotifyGive
+struct Native_task
+{
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable notified;
+  uint32_t notifications = 0;
+};
+
+static thread_local Native_task* current_task = nullptr;
+
+BaseType_t xTaskCreatePinnedToCore(
+  void (*task)(void*),
+  const char* const,
+  const uint32_t,
+  void* const parameter,
+  const unsigned,
+  TaskHandle_t* const handle,
+  const BaseType_t
+) {
+  // tasks of the firmware never end, neither does the task object
+  Native_task* const native_task = new Native_task();
+
+  if (handle != nullptr)
+    *handle = native_task;
+
+  native_task->thread = std::thread([native_task, task, parameter]() {
+    current_task = native_task;
+    task(parameter);
+  });
+  native_task->thread.detach();
+
+  return pdPASS;
+}
+
+void xTaskNotifyGive(TaskHandle_t task)
+{
+  {
+    std::lock_guard<std::mutex> lock(task->mutex);
+    task->notifications++;
+  }
+
+  task->notified.notify_one();
+}
+
+uint32_t ulTaskNotifyTake(const BaseType_t clear_on_exit, const TickType_t ticks)
+{
+  // the loop() thread is no task, it just waits
+  if (current_task == nullptr)
+  {
+    delay(ticks);
+    return 0;
+  }
+
+  std::unique_lock<std::mutex> lock(current_task->mutex);
+
+  if (ticks == portMAX_DELAY)
+    current_task->notified.wait(lock, []() { return current_task->notifications > 0; });
+  else
+    current_task->notified.wait_for(lock, std::chrono::milliseconds(ticks),
+      []() { return current_task->notifications > 0; });
+
+  const uint32_t notifications = current_task->notifications;
+
+  if (notifications > 0)
+    current_task->notifications = clear_on_exit ? 0 : notifications - 1;
+
+  return notifications;
+}
+
+void vTaskDelay(const TickType_t ticks)
+{
+  delay(ticks);
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+// Host stand-in of the ESP32 Arduino core for the native environment. Time is taken
+// from the host clock, GPIO is a no-op, FreeRTOS tasks run on threads and UARTs are
+// attached to in-process transports such as the H300 simulator.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "WString.h"
+
+#define LOW     0x0
+#define HIGH    0x1
+#define INPUT   0x01
+#define OUTPUT  0x03
+
+#define SERIAL_8N1  0x800001c
+#define SERIAL_8E1  0x800001e
+#define SERIAL_8O1  0x800001f
+
+#define F(string_literal) (string_literal)
+
+uint32_t micros();
+uint32_t millis();
+void delay(const uint32_t ms);
+void delayMicroseconds(const uint32_t us);
+
+inline void pinMode(const uint8_t, const uint8_t) {}
+inline void digitalWrite(const uint8_t, const uint8_t) {}
+
+class Stream
+{
+  public:
+    virtual ~Stream() {}
+
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual size_t write(const uint8_t* const buffer, const size_t size) = 0;
+    virtual void flush() {}
+};
+
+// UART, writes to the console until a transport is attached
+class HardwareSerial : public Stream
+{
+  public:
+    explicit HardwareSerial(const uint8_t uart) : uart(uart), transport(nullptr), baud_rate(0) {}
+
+    void begin(
+      const unsigned long baud_rate,
+      const uint32_t config = SERIAL_8N1,
+      const int8_t rx_pin = -1,
+      const int8_t tx_pin = -1
+    );
+    void end();
+
+    // native only, the transport receives everything written to the UART
+    void attach(Stream* const transport);
+
+    int available() override;
+    int read() override;
+    size_t write(const uint8_t* const buffer, const size_t size) override;
+    void flush() override;
+
+    size_t print(const char* const str);
+    size_t print(const String& str) { return print(str.c_str()); }
+    size_t println(const char* const str = "");
+    size_t println(const String& str) { return println(str.c_str()); }
+    size_t printf(const char* const format, ...) __attribute__((format(printf, 2, 3)));
+
+  private:
+    const uint8_t uart;
+    Stream* transport;
+    unsigned long baud_rate;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+extern HardwareSerial Serial2;
+
+// heap of the host is not limited, reported as 0
+class EspClass
+{
+  public:
+    uint32_t getFreeHeap() { return 0; }
+    uint32_t getMinFreeHeap() { return 0; }
+    uint32_t getMaxAllocHeap() { return 0; }
+};
+
+extern EspClass ESP;
+
+// FreeRTOS API used by the firmware, tasks are threads woken by their notification
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+typedef struct Native_task* TaskHandle_t;
+
+#define pdFALSE  0
+#define pdTRUE   1
+#define pdPASS   1
+#define pdFAIL   0
+#define portMAX_DELAY  0xFFFFFFFFu
+#define pdMS_TO_TICKS(ms)  ((TickType_t)(ms))
+
+BaseType_t xTaskCreatePinnedToCore(
+  void (*task)(void*),
+  const char* const name,
+  const uint32_t stack_depth,
+  void* const parameter,
+  const unsigned priority,
+  TaskHandle_t* const handle,
+  const BaseType_t core
+);
+void xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(const BaseType_t clear_on_exit, const TickType_t ticks);
+void vTaskDelay(const TickType_t ticks);
+
+void setup();
+void loop();
@@ -0,0 +1,8 @@
+#pragma once
+
+// Network client handed to the MQTT client, the native stand-ins never touch it
+class Client
+{
+  public:
+    virtual ~Client() {}
+};
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "WiFi.h"
+
+enum t_httpUpdate_return
+{
+  HTTP_UPDATE_FAILED,
+  HTTP_UPDATE_NO_UPDATES,
+  HTTP_UPDATE_OK
+};
+
+// There is no flash to update on the host, every update fails
+class HTTPUpdate
+{
+  public:
+    void setLedPin(const int, const uint8_t = LOW) {}
+
+    t_httpUpdate_return update(WiFiClient&, const String&)
+    {
+      return HTTP_UPDATE_FAILED;
+    }
+};
+
+extern HTTPUpdate httpUpdate;
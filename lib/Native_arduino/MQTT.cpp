@@ -0,0 +1,150 @@
+#include "MQTT.h"
+#include <algorithm>
+
+Local_broker& Local_broker::instance()
+{
+  static Local_broker broker;
+  return broker;
+}
+
+void Local_broker::inject(const std::string& topic, const std::string& payload)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  inbox.emplace_back(topic, payload);
+}
+
+void Local_broker::listen(Listener listener)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  this->listener = listener;
+}
+
+bool Local_broker::take(std::string& topic, std::string& payload)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  if (inbox.empty())
+    return false;
+
+  topic = inbox.front().first;
+  payload = inbox.front().second;
+  inbox.pop_front();
+  return true;
+}
+
+void Local_broker::published(const char* const topic, const char* const payload, const size_t length)
+{
+  Listener current;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // nobody listens, e.g. in benchmarks
+    if (!listener)
+      return;
+
+    current = listener;
+  }
+
+  current(topic, std::string(payload, length));
+}
+
+MQTTClient::MQTTClient(const int buffer_size)
+  : buffer_size(buffer_size), callback(nullptr), advanced_callback(nullptr), is_connected(false)
+{
+}
+
+void MQTTClient::begin(const char* const, const int, Client&)
+{
+}
+
+void MQTTClient::setOptions(const int, const bool, const int)
+{
+}
+
+void MQTTClient::onMessage(MQTTClientCallbackSimple callback)
+{
+  this->callback = callback;
+}
+
+void MQTTClient::onMessageAdvanced(MQTTClientCallbackAdvanced callback)
+{
+  advanced_callback = callback;
+}
+
+bool MQTTClient::setWill(const char* const, const char* const, const bool, const int)
+{
+  return true;
+}
+
+bool MQTTClient::connect(const char* const, const bool)
+{
+  subscriptions.clear();
+  is_connected = true;
+  return true;
+}
+
+bool MQTTClient::disconnect()
+{
+  is_connected = false;
+  return true;
+}
+
+bool MQTTClient::publish(const char* const topic, const char* const payload, const bool retained, const int qos)
+{
+  return publish(topic, payload, strlen(payload), retained, qos);
+}
+
+bool MQTTClient::publish(
+  const char* const topic,
+  const char* const payload,
+  const int length,
+  const bool,
+  const int
+) {
+  // packet has to fit the client buffer, as with the real client
+  const size_t packet_size = 5 + 2 + strlen(topic) + 2 + length;
+
+  if (!is_connected || packet_size > size_t(buffer_size))
+    return false;
+
+  Local_broker::instance().published(topic, payload, length);
+  return true;
+}
+
+bool MQTTClient::subscribe(const char* const topic, const int)
+{
+  subscriptions.push_back(topic);
+  return is_connected;
+}
+
+// Deliver the injected messages of the subscribed topics
+bool MQTTClient::loop()
+{
+  std::string topic;
+  std::string payload;
+
+  while (is_connected && Local_broker::instance().take(topic, payload))
+  {
+    if (std::find(subscriptions.begin(), subscriptions.end(), topic) == subscriptions.end())
+      continue;
+
+    // as the real client: NUL terminated topic and payload, the advanced callback takes precedence
+    if (advanced_callback != nullptr)
+    {
+      std::vector<char> topic_chars(topic.c_str(), topic.c_str() + topic.size() + 1);
+      std::vector<char> payload_chars(payload.c_str(), payload.c_str() + payload.size() + 1);
+      advanced_callback(this, &topic_chars[0], &payload_chars[0], payload.size());
+      continue;
+    }
+
+    if (callback == nullptr)
+      continue;
+
+    String topic_string(topic);
+    String payload_string(payload);
+    callback(topic_string, payload_string);
+  }
+
+  return is_connected;
+}
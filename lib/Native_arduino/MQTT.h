@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "Client.h"
+
+class MQTTClient;
+
+typedef void (*MQTTClientCallbackSimple)(String& topic, String& payload);
+typedef void (*MQTTClientCallbackAdvanced)(MQTTClient* client, char topic[], char bytes[], int length);
+
+// In-process stand-in of the gateway broker. Messages injected here are delivered
+// to the subscribed client on its next loop(), everything the client publishes is
+// handed to the listener. Injecting is safe from any thread.
+class Local_broker
+{
+  public:
+    typedef std::function<void(const std::string& topic, const std::string& payload)> Listener;
+
+    static Local_broker& instance();
+
+    void inject(const std::string& topic, const std::string& payload);
+    void listen(Listener listener);
+
+    bool take(std::string& topic, std::string& payload);
+    void published(const char* const topic, const char* const payload, const size_t length);
+
+  private:
+    std::mutex mutex;
+    std::deque<std::pair<std::string, std::string>> inbox;
+    Listener listener;
+};
+
+// API of the 256dpi MQTT client used by the firmware, connected to the local broker
+class MQTTClient
+{
+  public:
+    explicit MQTTClient(const int buffer_size = 128);
+    virtual ~MQTTClient() {}
+
+    void begin(const char* const hostname, const int port, Client& client);
+    void setOptions(const int keep_alive, const bool clean_session, const int timeout);
+    void onMessage(MQTTClientCallbackSimple callback);
+    void onMessageAdvanced(MQTTClientCallbackAdvanced callback);
+    bool setWill(const char* const topic, const char* const payload, const bool retained, const int qos);
+
+    bool connect(const char* const client_id, const bool skip = false);
+    bool disconnect();
+    bool connected() const { return is_connected; }
+
+    bool publish(const char* const topic, const char* const payload, const bool retained = false, const int qos = 0);
+    bool publish(
+      const char* const topic,
+      const char* const payload,
+      const int length,
+      const bool retained = false,
+      const int qos = 0
+    );
+    bool subscribe(const char* const topic, const int qos = 0);
+
+    bool loop();
+
+  private:
+    const int buffer_size;
+    MQTTClientCallbackSimple callback;
+    MQTTClientCallbackAdvanced advanced_callback;
+    bool is_connected;
+    std::vector<std::string> subscriptions;
+};
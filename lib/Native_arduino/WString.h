@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <type_traits>
+
+// Arduino String on top of std::string, only the part used by the firmware
+class String
+{
+  public:
+    String(const char* const str = "") : value(str != nullptr ? str : "") {}
+    String(const std::string& str) : value(str) {}
+    explicit String(const char c) : value(1, c) {}
+
+    // numbers are converted to their decimal text, as by the Arduino core
+    template <typename T, typename std::enable_if<
+      std::is_arithmetic<T>::value && !std::is_same<T, char>::value, int>::type = 0>
+    explicit String(const T number) : value(std::to_string(number)) {}
+
+    const char* c_str() const { return value.c_str(); }
+    size_t length() const { return value.size(); }
+
+    bool equals(const String& other) const { return value == other.value; }
+    bool operator==(const String& other) const { return value == other.value; }
+    bool operator!=(const String& other) const { return value != other.value; }
+
+    bool concat(const String& other) { value += other.value; return true; }
+    bool concat(const char* const str) { value += str; return true; }
+    bool concat(const char c) { value += c; return true; }
+
+    String& operator+=(const String& other) { value += other.value; return *this; }
+    String& operator+=(const char* const str) { value += str; return *this; }
+    String& operator+=(const char c) { value += c; return *this; }
+
+  private:
+    std::string value;
+};
+
+// result type of String concatenation in the Arduino core, ArduinoJson refers to it
+class StringSumHelper : public String
+{
+  public:
+    StringSumHelper(const String& str) : String(str) {}
+};
+
+inline StringSumHelper operator+(const String& lhs, const String& rhs)
+{
+  String sum(lhs);
+  sum += rhs;
+  return sum;
+}
+
+inline StringSumHelper operator+(const String& lhs, const char* const rhs)
+{
+  String sum(lhs);
+  sum += rhs;
+  return sum;
+}
+
+inline StringSumHelper operator+(const char* const lhs, const String& rhs)
+{
+  String sum(lhs);
+  sum += rhs;
+  return sum;
+}
+
+inline StringSumHelper operator+(const String& lhs, const char rhs)
+{
+  String sum(lhs);
+  sum += rhs;
+  return sum;
+}
+
+template <typename T, typename std::enable_if<
+  std::is_arithmetic<T>::value && !std::is_same<T, char>::value, int>::type = 0>
+inline StringSumHelper operator+(const String& lhs, const T rhs)
+{
+  String sum(lhs);
+  sum += String(rhs);
+  return sum;
+}
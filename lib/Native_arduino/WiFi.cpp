@@ -0,0 +1,5 @@
+#include "WiFi.h"
+#include "HTTPUpdate.h"
+
+WiFiClass WiFi;
+HTTPUpdate httpUpdate;
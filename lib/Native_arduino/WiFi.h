@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+#include "Arduino.h"
+#include "Client.h"
+
+typedef uint8_t wl_status_t;
+
+enum
+{
+  WL_IDLE_STATUS = 0,
+  WL_CONNECTED = 3,
+  WL_DISCONNECTED = 6
+};
+
+class IPAddress
+{
+  public:
+    constexpr IPAddress(const uint8_t a, const uint8_t b, const uint8_t c, const uint8_t d)
+      : octets{ a, b, c, d } {}
+
+    String toString() const
+    {
+      char text[16];
+      snprintf(text, sizeof(text), "%u.%u.%u.%u", octets[0], octets[1], octets[2], octets[3]);
+      return String(text);
+    }
+
+  private:
+    uint8_t octets[4];
+};
+
+class WiFiClient : public Client
+{
+};
+
+// Station always connected to the loopback network, the broker stand-in is in-process
+class WiFiClass
+{
+  public:
+    constexpr WiFiClass() : state(WL_DISCONNECTED) {}
+
+    void begin(const char* const, const char* const) { state = WL_CONNECTED; }
+    void disconnect(const bool = false) { state = WL_DISCONNECTED; }
+    wl_status_t status() const { return state; }
+
+    String macAddress() const { return String("02:00:00:00:00:01"); }
+    IPAddress localIP() const { return IPAddress(127, 0, 0, 1); }
+    IPAddress gatewayIP() const { return IPAddress(127, 0, 0, 1); }
+
+  private:
+    wl_status_t state;
+};
+
+extern WiFiClass WiFi;
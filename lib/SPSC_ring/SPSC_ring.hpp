@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <atomic>
+
+// Bounded lock-free single-producer single-consumer ring buffer.
+// One task may only push, the other one may only pop. Depends on the
+// standard library only, so it builds and can be tested on the host.
+template <typename T, size_t Capacity>
+class SPSC_ring
+{
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+  public:
+    SPSC_ring() : head(0), tail(0) {}
+
+    // producer side, false if the ring is full
+    bool push(const T& item)
+    {
+      const size_t tail_pos = tail.load(std::memory_order_relaxed);
+
+      if (tail_pos - head.load(std::memory_order_acquire) == Capacity)
+        return false;
+
+      items[tail_pos & (Capacity - 1)] = item;
+      tail.store(tail_pos + 1, std::memory_order_release);
+      return true;
+    }
+
+    // consumer side, false if the ring is empty
+    bool pop(T& item)
+    {
+      const size_t head_pos = head.load(std::memory_order_relaxed);
+
+      if (head_pos == tail.load(std::memory_order_acquire))
+        return false;
+
+      item = items[head_pos & (Capacity - 1)];
+      head.store(head_pos + 1, std::memory_order_release);
+      return true;
+    }
+
+    size_t size() const
+    {
+      return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    bool empty() const { return size() == 0; }
+    static constexpr size_t capacity() { return Capacity; }
+
+  private:
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+    T items[Capacity];
+};
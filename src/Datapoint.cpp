@@ -0,0 +1,104 @@
+#include "Datapoint.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+constexpr const char* Datapoints::get_motion_labels[];
+constexpr const char* Datapoints::set_motion_labels[];
+constexpr Datapoint Datapoints::table[];
+
+void Datapoint::decode(const uint16_t raw, JsonObject& object) const
+{
+  switch (type)
+  {
+    case Type::NUMBER:
+      object[code] = float(raw) * multiplier / divisor;
+      break;
+
+    case Type::INTEGER:
+      object[code] = raw;
+      break;
+
+    case Type::ENUM:
+      // unknown values are left out of the update
+      if (raw >= label_base && raw - label_base < label_count)
+        object[code] = labels[raw - label_base];
+      break;
+
+    case Type::STATE:
+      if (raw == 0)
+        object[code] = "OK";
+      else
+      {
+        // non-const buffer makes ArduinoJson copy the string
+        char state[12];
+        snprintf(state, sizeof(state), "ERROR %u", raw);
+        object[code] = static_cast<char*>(state);
+      }
+      break;
+  }
+}
+
+// Convert value received in SET_VALUE to the raw register value
+bool Datapoint::encode(const char* const value, uint16_t* const raw) const
+{
+  if (!writable || value == nullptr)
+    return false;
+
+  switch (type)
+  {
+    case Type::NUMBER:
+    case Type::INTEGER:
+    {
+      const double scaled = atof(value) * divisor / multiplier + 0.5;
+
+      if (scaled < 0 || scaled >= 65536)
+        return false;
+
+      *raw = uint16_t(scaled);
+      return true;
+    }
+
+    case Type::ENUM:
+      for (uint8_t i = 0; i < label_count; i++)
+      {
+        if (strcmp(value, labels[i]) == 0)
+        {
+          *raw = label_base + i;
+          return true;
+        }
+      }
+      return false;
+
+    default:
+      return false;
+  }
+}
+
+// Convert a difference of values (e.g. deadband) to raw register units
+uint16_t Datapoint::raw_delta(const float delta) const
+{
+  if (type != Type::NUMBER && type != Type::INTEGER)
+    return 0;
+
+  const float raw = delta * divisor / multiplier + 0.5f;
+
+  if (raw <= 0)
+    return 0;
+
+  return raw >= 65535 ? 65535 : uint16_t(raw);
+}
+
+// O(1) lookup by datapoint code using the perfect hash table
+const Datapoint* Datapoint::find(const char* const code)
+{
+  if (code == nullptr)
+    return nullptr;
+
+  const int8_t index = Datapoint_hash::lookup::slots[Datapoint_hash::slot(code)];
+
+  if (index < 0 || strcmp(Datapoints::table[index].code, code) != 0)
+    return nullptr;
+
+  return &Datapoints::table[index];
+}
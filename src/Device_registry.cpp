@@ -0,0 +1,142 @@
+#include "Device_registry.hpp"
+#include <string.h>
+
+constexpr uint16_t Device_registry::not_found;
+constexpr uint16_t Device_registry::unit_count;
+
+Device_registry::Device_registry()
+{
+  clear();
+}
+
+void Device_registry::clear()
+{
+  ids.clear();
+  hashes.clear();
+  slots.assign(16, not_found);
+  units.assign(Bus_config::max_buses * unit_count, not_found);
+}
+
+// Size the tables for the device count up front, so that adding does not rehash
+void Device_registry::reserve(const uint16_t count)
+{
+  ids.reserve(count);
+  hashes.reserve(count);
+
+  size_t slot_count = slots.size();
+
+  while (slot_count < 2u * count)
+    slot_count *= 2;
+
+  if (slot_count != slots.size())
+    rehash(slot_count);
+}
+
+Device_registry::Result Device_registry::add(const char* const device_id, const uint8_t bus_index, const uint8_t unit_id)
+{
+  // unit 0 would turn every read and write of the device into a broadcast
+  if (device_id == nullptr || bus_index >= Bus_config::max_buses || ids.size() >= not_found)
+    return Result::INVALID;
+
+  if (unit_id == Modbus_RTU::broadcast_address || unit_id > Modbus_RTU::max_unit_address)
+    return Result::INVALID;
+
+  size_t length;
+  const uint32_t id_hash = hash(device_id, &length);
+
+  if (find(device_id, length, id_hash) != not_found)
+    return Result::DUPLICATE_ID;
+
+  uint16_t& unit = units[bus_index * unit_count + unit_id];
+
+  if (unit != not_found)
+    return Result::DUPLICATE_UNIT;
+
+  // table is kept at most half full, probe sequences stay short
+  if (2 * (ids.size() + 1) > slots.size())
+    rehash(2 * slots.size());
+
+  const uint16_t index = ids.size();
+  size_t slot = id_hash & (slots.size() - 1);
+
+  while (slots[slot] != not_found)
+    slot = (slot + 1) & (slots.size() - 1);
+
+  slots[slot] = index;
+  unit = index;
+  ids.emplace_back(device_id, length);
+  hashes.push_back(id_hash);
+
+  return Result::ADDED;
+}
+
+// Index of the device with the id, not_found if there is none
+uint16_t Device_registry::find(const char* const device_id) const
+{
+  if (device_id == nullptr)
+    return not_found;
+
+  size_t length;
+  const uint32_t id_hash = hash(device_id, &length);
+
+  return find(device_id, length, id_hash);
+}
+
+// Index of the device with the Modbus address on the bus, not_found if there is none
+uint16_t Device_registry::find_unit(const uint8_t bus_index, const uint8_t unit_id) const
+{
+  if (bus_index >= Bus_config::max_buses)
+    return not_found;
+
+  return units[bus_index * unit_count + unit_id];
+}
+
+void Device_registry::swap(Device_registry& other)
+{
+  ids.swap(other.ids);
+  hashes.swap(other.hashes);
+  slots.swap(other.slots);
+  units.swap(other.units);
+}
+
+uint16_t Device_registry::find(const char* const device_id, const size_t length, const uint32_t hash) const
+{
+  // linear probing up to the first empty slot, ids are compared only on a full hash match
+  for (size_t slot = hash & (slots.size() - 1); slots[slot] != not_found; slot = (slot + 1) & (slots.size() - 1))
+  {
+    const uint16_t index = slots[slot];
+
+    if (hashes[index] == hash && ids[index].size() == length && memcmp(ids[index].data(), device_id, length) == 0)
+      return index;
+  }
+
+  return not_found;
+}
+
+void Device_registry::rehash(const size_t slot_count)
+{
+  slots.assign(slot_count, not_found);
+
+  for (uint16_t index = 0; index < hashes.size(); index++)
+  {
+    size_t slot = hashes[index] & (slot_count - 1);
+
+    while (slots[slot] != not_found)
+      slot = (slot + 1) & (slot_count - 1);
+
+    slots[slot] = index;
+  }
+}
+
+// FNV-1a of the id, its length on the way
+uint32_t Device_registry::hash(const char* const device_id, size_t* const length)
+{
+  uint32_t state = 2166136261u;
+  size_t i = 0;
+
+  for (; device_id[i] != '\0'; i++)
+    state = (state ^ uint8_t(device_id[i])) * 16777619u;
+
+  *length = i;
+  return state;
+}
@@ -0,0 +1,103 @@
+#include "Device_stats.hpp"
+
+// counters saturate instead of wrapping when the stats are not taken for long
+static void increment(uint16_t& counter)
+{
+  if (counter < UINT16_MAX)
+    counter++;
+}
+
+// Cheap enough to run on every transaction: a few increments and a bit scan
+void Device_stats::record(const Modbus_RTU::Transaction& transaction)
+{
+  increment(transactions);
+
+  switch (transaction.result)
+  {
+    case Modbus_RTU::response_timed_out:
+      increment(timeouts);
+      return;
+
+    case Modbus_RTU::invalid_crc:
+      increment(crc_errors);
+      return;
+
+    case Modbus_RTU::success:
+      break;
+
+    case Modbus_RTU::illegal_function:
+    case Modbus_RTU::illegal_data_address:
+    case Modbus_RTU::illegal_data_value:
+    case Modbus_RTU::slave_device_failure:
+      increment(exceptions[transaction.result - Modbus_RTU::illegal_function]);
+      break;
+
+    default:
+      increment(other_errors);
+      return;
+  }
+
+  // broadcasts are never answered
+  if (transaction.unit_id != Modbus_RTU::broadcast_address)
+    increment(latency_histogram[bucket(transaction.latency_us)]);
+}
+
+// Latency the given share of the answered requests stayed within, 0 without any
+uint32_t Device_stats::percentile_us(const uint8_t percent) const
+{
+  const uint32_t count = answered();
+
+  if (count == 0)
+    return 0;
+
+  // rank of the percentile, rounded up
+  const uint32_t rank = (count * percent + 99) / 100;
+  uint32_t cumulative = 0;
+
+  for (uint8_t i = 0; i < latency_buckets; i++)
+  {
+    cumulative += latency_histogram[i];
+
+    if (cumulative >= rank && cumulative > 0)
+      return bucket_limit_us(i);
+  }
+
+  return bucket_limit_us(latency_buckets - 1);
+}
+
+uint16_t Device_stats::answered() const
+{
+  uint32_t count = 0;
+
+  for (const uint16_t bucket_count : latency_histogram)
+    count += bucket_count;
+
+  return count < UINT16_MAX ? count : UINT16_MAX;
+}
+
+// Bucket 0 holds latencies below min_latency_us, each further octave is split in halves
+uint8_t Device_stats::bucket(const uint32_t latency_us)
+{
+  if (latency_us < min_latency_us)
+    return 0;
+
+  // octave 0 is min_latency_us up to twice of it
+  const uint8_t octave = (31 - __builtin_clz(latency_us)) - (31 - __builtin_clz(min_latency_us));
+  const uint8_t half = (latency_us >> (octave + 7)) & 1;
+  const uint8_t index = 1 + 2 * octave + half;
+
+  return index < latency_buckets ? index : latency_buckets - 1;
+}
+
+// Upper bound of the bucket, the last one is open and reports its lower bound
+uint32_t Device_stats::bucket_limit_us(const uint8_t bucket)
+{
+  if (bucket == 0)
+    return min_latency_us;
+
+  const uint8_t octave = (bucket - 1) / 2;
+  const uint8_t half = (bucket - 1) & 1;
+  const uint32_t lower = (min_latency_us << octave) + half * ((min_latency_us / 2) << octave);
+
+  return bucket == latency_buckets - 1 ? lower : lower + ((min_latency_us / 2) << octave);
+}
@@ -1,65 +1,504 @@
 #include "H300.hpp"
 #include <stdint.h>
+#include <string.h>
 #include <Arduino.h>
 
-H300::H300(const std::string device_id, const uint8_t unit_id, const uint32_t poll_rate)
-  : device_id(device_id), unit_id(unit_id), poll_rate(poll_rate)
+constexpr uint16_t H300::cached_registers[];
+
+H300::H300(const uint8_t bus_index, const std::string device_id, const uint8_t unit_id, const uint32_t poll_rate)
+  : bus(nullptr), scan_planner(nullptr), scan_pending(0), scan_registers(0), bus_index(bus_index),
+    device_id(device_id), unit_id(unit_id), poll_rate(poll_rate), scan_valid(0), snapshot_interval(default_snapshot_interval),
+    enabled_datapoints(UINT16_MAX), revalidate_interval(default_revalidate_interval), published_valid(0),
+    last_snapshot(0), snapshot_taken(false), polled_once(0), cache_valid(0), health_state(Health::ONLINE),
+    unanswered_scans(0), scan_answered(false), offline_report(false), probe_interval(min_probe_interval),
+    last_probe(0), first_byte_avg_us(0), first_byte_dev_us(0)
 {
-  iteration_counter = poll_rate;
-  
-  pinMode(MAX485_RE_NEG, OUTPUT);
-  pinMode(MAX485_DE, OUTPUT);
+  for (uint8_t i = 0; i < max_datapoints; i++)
+  {
+    deadbands[i] = 0;
+    poll_rates[i] = 0;
+  }
+}
+
+// Bus the device is connected to, set by the poller once the bus is open
+void H300::attach(Modbus_RTU& bus)
+{
+  this->bus = &bus;
+}
+
+// Runtime state of the same drive in the previous device set, so that a new configuration
+// does not drop its cached and published values, poll times, health and stats. Settings
+// are those of the new configuration.
+void H300::take_state(const H300& previous)
+{
+  memcpy(published, previous.published, sizeof(published));
+  published_valid = previous.published_valid;
+  last_snapshot = previous.last_snapshot;
+  // the MQTT side drops the pass in progress along with the previous configuration
+  snapshot_taken = false;
+
+  memcpy(last_polled, previous.last_polled, sizeof(last_polled));
+  polled_once = previous.polled_once;
+
+  memcpy(cache_values, previous.cache_values, sizeof(cache_values));
+  memcpy(cache_since, previous.cache_since, sizeof(cache_since));
+  cache_valid = previous.cache_valid;
 
-  // Init in receive mode
-  digitalWrite(MAX485_RE_NEG, 0);
-  digitalWrite(MAX485_DE, 0);
+  health_state = previous.health_state;
+  unanswered_scans = previous.unanswered_scans;
+  offline_report = previous.offline_report;
+  probe_interval = previous.probe_interval;
+  last_probe = previous.last_probe;
+  first_byte_avg_us = previous.first_byte_avg_us;
+  first_byte_dev_us = previous.first_byte_dev_us;
+
+  stats = previous.stats;
+}
+
+// Queue write of value to holding register, result is reported through the callback
+bool H300::write_value(
+  const uint16_t register_addr,
+  const uint16_t value,
+  Modbus_RTU::Callback callback,
+  void* const context,
+  const uint32_t tag
+) const {
+  if (bus == nullptr)
+    return false;
+
+  return bus->write_single_register(unit_id, register_addr, value, callback, context, tag);
+}
+
+// Queue write of values to consecutive holding registers in one frame
+bool H300::write_values(
+  const uint16_t start,
+  const uint8_t count,
+  const uint16_t* const values,
+  Modbus_RTU::Callback callback,
+  void* const context,
+  const uint32_t tag
+) const {
+  if (bus == nullptr)
+    return false;
+
+  return bus->write_multiple_registers(unit_id, start, count, values, callback, context, tag);
+}
 
-  // Modbus communication through hardware bus
-  serial_bus.begin(baud_rate);
-  node.begin(unit_id, serial_bus);
+// Queue read of single holding register, value is reported through the callback. The device
+// is given the first byte timeout learned from its scans, see first_byte_timeout_us().
+bool H300::read_value(
+  const uint16_t register_addr,
+  Modbus_RTU::Callback callback,
+  void* const context,
+  const uint32_t tag
+) const {
+  if (bus == nullptr)
+    return false;
 
-  // Callbacks allow us to configure the RS485 transceiver correctly
-  node.preTransmission(pre_transmission);
-  node.postTransmission(post_transmission);
+  return bus->read_holding_registers(unit_id, register_addr, 1, callback, context, tag, first_byte_timeout_us());
 }
 
-void H300::pre_transmission() 
+// Queue reads of the given registers (bit mask of planner register indices), values are
+// collected into scan_values as the responses arrive. Ranges of the plan without any given
+// register are skipped, the others are trimmed to the given registers. Scan is finished
+// when scan_complete() returns true.
+bool H300::start_scan(Read_planner& planner, const uint16_t registers)
 {
-  digitalWrite(MAX485_RE_NEG, 1);
-  digitalWrite(MAX485_DE, 1);
+  scan_planner = &planner;
+  scan_registers = registers;
+  scan_valid = 0;
+  scan_pending = 0;
+  scan_answered = false;
+
+  if (bus == nullptr)
+    return false;
+
+  const uint32_t timeout_us = first_byte_timeout_us();
+
+  for (uint8_t i = 0; i < planner.range_count(); i++)
+  {
+    const Read_planner::Range& range = planner.range_at(i);
+    const uint16_t end = range.start + range.count;
+    uint16_t first = end;
+    uint16_t last = range.start;
+
+    for (uint8_t j = 0; j < planner.register_count(); j++)
+    {
+      const uint16_t register_addr = planner.register_at(j);
+
+      if (!(registers & (1u << j)) || register_addr < range.start || register_addr >= end)
+        continue;
+
+      first = register_addr < first ? register_addr : first;
+      last = register_addr > last ? register_addr : last;
+    }
+
+    if (first == end)
+      continue;
+
+    if (bus->read_holding_registers(unit_id, first, last - first + 1, scan_callback, this, 0, timeout_us))
+      scan_pending++;
+  }
+
+  return scan_pending > 0;
+}
+
+// Read a single register of an offline device with the full bus timeout, the device is
+// online again once it answers. Finished when scan_complete() returns true.
+bool H300::start_probe()
+{
+  scan_valid = 0;
+  scan_pending = 0;
+  last_probe = millis();
+
+  if (bus == nullptr || !bus->read_holding_registers(unit_id, state_register, 1, probe_callback, this))
+    return false;
+
+  scan_pending = 1;
+  return true;
 }
 
-void H300::post_transmission() 
+bool H300::scan_complete() const
 {
-  digitalWrite(MAX485_RE_NEG, 0);
-  digitalWrite(MAX485_DE, 0);
+  return scan_pending == 0;
 }
 
-// Write value to holding register
-uint8_t H300::write_value(const uint16_t register_addr, const uint16_t value) const 
+H300::Health H300::health() const
 {
-  return node.writeSingleRegister(register_addr, value);
+  return health_state;
 }
 
-// Read value from holding register
-uint8_t H300::read_value(const uint16_t register_addr, uint16_t* const response) const 
+bool H300::probe_due(const uint32_t now) const
 {
-  const uint8_t result = node.readHoldingRegisters(register_addr, 1);
+  return now - last_probe >= probe_interval;
+}
 
-  if (result == node.ku8MBSuccess)
-    *response = node.getResponseBuffer(0);
+// True once after the device went offline, so that it is reported a single time
+bool H300::take_offline_report()
+{
+  const bool report = offline_report;
+  offline_report = false;
 
-  return result;
+  return report;
 }
 
-bool H300::decrease_counter() 
+// Time the device is given to start its response, derived from the delays it answered
+// with so far the way TCP derives its retransmission timeout. 0 leaves the full bus
+// timeout, used until the device answers and while it does not answer.
+uint32_t H300::first_byte_timeout_us() const
 {
-  iteration_counter--;
+  if (health_state != Health::ONLINE || first_byte_avg_us == 0)
+    return 0;
+
+  const uint32_t timeout_us = first_byte_avg_us + 4 * first_byte_dev_us;
+
+  if (timeout_us < min_first_byte_timeout_us)
+    return min_first_byte_timeout_us;
+
+  return timeout_us;
+}
+
+// Any transaction of the device, counted in its stats and teaching the response delay
+void H300::record(const Modbus_RTU::Transaction& transaction)
+{
+  stats.record(transaction);
+
+  if (transaction.result == Modbus_RTU::response_timed_out || transaction.unit_id == Modbus_RTU::broadcast_address)
+    return;
+
+  const uint32_t sample_us = transaction.first_byte_us;
+
+  if (first_byte_avg_us == 0)
+  {
+    first_byte_avg_us = sample_us > 0 ? sample_us : 1;
+    first_byte_dev_us = sample_us / 2;
+    return;
+  }
+
+  // gains 1/8 and 1/4 as in RFC 6298
+  const uint32_t error_us = sample_us > first_byte_avg_us ? sample_us - first_byte_avg_us : first_byte_avg_us - sample_us;
+  first_byte_dev_us = first_byte_dev_us - first_byte_dev_us / 4 + error_us / 4;
+  first_byte_avg_us = first_byte_avg_us - first_byte_avg_us / 8 + sample_us / 8;
+
+  if (first_byte_avg_us == 0)
+    first_byte_avg_us = 1;
+}
+
+// Scheduling period of the device, the shortest poll rate of its enabled datapoints
+uint32_t H300::scan_period() const
+{
+  uint32_t period = 0;
+
+  for (uint8_t i = 0; i < max_datapoints; i++)
+  {
+    if (!(enabled_datapoints & (1u << i)))
+      continue;
+
+    const uint32_t rate = poll_rates[i] ? poll_rates[i] : poll_rate;
+
+    if (period == 0 || rate < period)
+      period = rate;
+  }
+
+  return period ? period : poll_rate;
+}
+
+// Enabled datapoints whose poll rate elapsed, half of the scan period is tolerated
+// so that a datapoint is not postponed by a whole period due to scheduling jitter
+uint16_t H300::due_datapoints(const uint32_t now) const
+{
+  const uint32_t tolerance = scan_period() / 2;
+  uint16_t due = 0;
+
+  for (uint8_t i = 0; i < max_datapoints; i++)
+  {
+    const uint16_t bit = 1u << i;
+    const uint32_t rate = poll_rates[i] ? poll_rates[i] : poll_rate;
+
+    if ((enabled_datapoints & bit) && (!(polled_once & bit) || now - last_polled[i] + tolerance >= rate))
+      due |= bit;
+  }
+
+  return due;
+}
+
+void H300::mark_polled(const uint16_t datapoints, const uint32_t now)
+{
+  for (uint8_t i = 0; i < max_datapoints; i++)
+    if (datapoints & (1u << i))
+      last_polled[i] = now;
+
+  polled_once |= datapoints;
+}
+
+void H300::scan_callback(void* context, const Modbus_RTU::Transaction& transaction)
+{
+  H300* const device = static_cast<H300*>(context);
+  Read_planner& planner = *device->scan_planner;
+  const uint16_t end = transaction.start + transaction.count;
+
+  device->record(transaction);
 
-  if (iteration_counter == 0) {
-    iteration_counter = poll_rate;
-    return true;
-  } 
+  if (transaction.result != Modbus_RTU::response_timed_out)
+    device->scan_answered = true;
+  else if (!device->scan_answered)
+  {
+    // silent device, the rest of the scan would only time out as well
+    device->bus->cancel(device);
+    device->invalidate_cache();
+    device->scan_pending = 0;
+    device->finish_scan(millis());
+    return;
+  }
 
-  return false;
+  // drive refused to read over the gap, fall back to single reads of this range. They are
+  // counted before this read is retired, so the scan finishes once, after the last of them.
+  if (transaction.result == Modbus_RTU::illegal_data_address && transaction.count > 1)
+  {
+    for (uint8_t i = 0; i < planner.range_count(); i++)
+    {
+      const Read_planner::Range& range = planner.range_at(i);
+
+      // the read may have been trimmed to a part of the range
+      if (range.count > 1 && range.start <= transaction.start && range.start + range.count >= end)
+        planner.split_range(i);
+    }
+
+    for (uint8_t i = 0; i < planner.register_count(); i++)
+    {
+      const uint16_t register_addr = planner.register_at(i);
+
+      if ((device->scan_registers & (1u << i)) && register_addr >= transaction.start && register_addr < end
+        && device->bus->read_holding_registers(
+          device->unit_id, register_addr, 1, scan_callback, device, 0, device->first_byte_timeout_us()
+        ))
+        device->scan_pending++;
+    }
+  }
+  else if (transaction.result != Modbus_RTU::success)
+  {
+    // drive may have been reset or reconfigured locally, do not trust the cache anymore
+    device->invalidate_cache();
+  }
+  else
+  {
+    const uint32_t now = millis();
+
+    for (uint8_t i = 0; i < planner.register_count(); i++)
+    {
+      const uint16_t register_addr = planner.register_at(i);
+
+      if (register_addr >= transaction.start && register_addr < end)
+      {
+        const uint16_t value = transaction.values[register_addr - transaction.start];
+
+        device->scan_values[i] = value;
+        device->scan_valid |= 1u << i;
+        device->cache_store(register_addr, value, now);
+
+        if (register_addr == state_register && value != 0)
+          device->invalidate_cache();
+      }
+    }
+  }
+
+  if (--device->scan_pending == 0)
+    device->finish_scan(millis());
+}
+
+void H300::probe_callback(void* context, const Modbus_RTU::Transaction& transaction)
+{
+  H300* const device = static_cast<H300*>(context);
+
+  device->scan_pending--;
+  device->record(transaction);
+
+  if (transaction.result == Modbus_RTU::response_timed_out)
+  {
+    if (device->probe_interval < max_probe_interval)
+      device->probe_interval *= 2;
+
+    return;
+  }
+
+  // back online, the next scan reads and publishes everything
+  device->health_state = Health::ONLINE;
+  device->unanswered_scans = 0;
+  device->offline_report = false;
+  device->probe_interval = min_probe_interval;
+  device->polled_once = 0;
+  device->snapshot_taken = false;
+}
+
+// Health of the device after all reads of its scan finished
+void H300::finish_scan(const uint32_t now)
+{
+  if (scan_answered)
+  {
+    health_state = Health::ONLINE;
+    unanswered_scans = 0;
+    return;
+  }
+
+  if (++unanswered_scans < offline_after)
+  {
+    health_state = Health::SUSPECT;
+    return;
+  }
+
+  health_state = Health::OFFLINE;
+  offline_report = true;
+  probe_interval = min_probe_interval;
+  last_probe = now;
+  invalidate_cache();
+}
+
+int8_t H300::cache_index(const uint16_t register_addr)
+{
+  for (uint8_t i = 0; i < cached_count; i++)
+    if (cached_registers[i] == register_addr)
+      return i;
+
+  return -1;
+}
+
+// Value of a cached register, false if the register is not cached or has to be read
+bool H300::cache_lookup(const uint16_t register_addr, uint16_t* const value) const
+{
+  const int8_t index = cache_index(register_addr);
+
+  if (index < 0 || !(cache_valid & (1u << index)))
+    return false;
+
+  if (value != nullptr)
+    *value = cache_values[index];
+
+  return true;
+}
+
+// Value read from or successfully written to the drive, other registers are ignored
+void H300::cache_store(const uint16_t register_addr, const uint16_t value, const uint32_t now)
+{
+  const int8_t index = cache_index(register_addr);
+
+  if (index < 0)
+    return;
+
+  cache_values[index] = value;
+  cache_since[index] = now;
+  cache_valid |= 1u << index;
+}
+
+void H300::invalidate_cache(const uint16_t register_addr)
+{
+  const int8_t index = cache_index(register_addr);
+
+  if (index >= 0)
+    cache_valid &= ~(1u << index);
+}
+
+void H300::invalidate_cache()
+{
+  cache_valid = 0;
+}
+
+// Drop cached values older than revalidate_interval so that they are read again
+void H300::expire_cache(const uint32_t now)
+{
+  for (uint8_t i = 0; i < cached_count; i++)
+    if ((cache_valid & (1u << i)) && now - cache_since[i] >= revalidate_interval)
+      cache_valid &= ~(1u << i);
+}
+
+bool H300::snapshot_due(const uint32_t now) const
+{
+  return snapshot_interval == 0 || !snapshot_taken || now - last_snapshot >= snapshot_interval;
+}
+
+// Select datapoints of a scan to be published: those which moved beyond their deadband
+// since they were last published, or all of them when a full snapshot is due. Nothing
+// counts as published until mark_reported().
+uint16_t H300::report_changes(const uint16_t* const raw, const uint16_t valid, const uint32_t now) const
+{
+  const bool snapshot = snapshot_due(now);
+  uint16_t report = 0;
+
+  for (uint8_t i = 0; i < max_datapoints; i++)
+  {
+    const uint16_t bit = 1u << i;
+
+    if (!(valid & bit))
+      continue;
+
+    const uint16_t delta = raw[i] > published[i] ? raw[i] - published[i] : published[i] - raw[i];
+
+    if (snapshot || !(published_valid & bit) || delta > deadbands[i])
+      report |= bit;
+  }
+
+  return report;
+}
+
+// Datapoints selected by report_changes() reached the MQTT side
+void H300::mark_reported(const uint16_t* const raw, const uint16_t report, const uint32_t now)
+{
+  if (snapshot_due(now))
+  {
+    last_snapshot = now;
+    snapshot_taken = true;
+  }
+
+  for (uint8_t i = 0; i < max_datapoints; i++)
+  {
+    if (report & (1u << i))
+      published[i] = raw[i];
+  }
+
+  published_valid |= report;
+}
+
+// Values reported since the last snapshot may have been lost, the next scan reports all
+void H300::force_snapshot()
+{
+  snapshot_taken = false;
 }
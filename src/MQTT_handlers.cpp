@@ -0,0 +1,725 @@
+#include "MQTT_handlers.hpp"
+#include <ArduinoJson.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <MD5.hpp>
+#include <Modbus_RTU.hpp>
+#include "Bus_config.hpp"
+#include "H300.hpp"
+#include "Datapoint.hpp"
+#include "Log.hpp"
+
+static Poller      *poller = nullptr;
+static MQTT_client *mqtt_client = nullptr;
+static FW_updater  *fw_updater = nullptr;
+
+// publish buffers of the loop are sized after the device count and the encoding
+static void (*reserve_buffers)() = nullptr;
+
+static Device_registry device_registry;
+static uint32_t config_generation = 0;
+
+// MD5 of the SET_CONFIG payload in effect, the same payload again is not applied
+static char config_hash[MD5::digest_length + 1] = "";
+
+// encoding negotiated by the gateway, kept across reconnects
+static MQTT_client::Encoding value_encoding = MQTT_client::Encoding::JSON;
+
+// batched SET_VALUE waiting for its writes, answered by one REQUEST_RESULT. Results of its
+// writes are matched by the id, the gateway may reuse the sequence number meanwhile.
+struct Write_batch
+{
+  uint16_t id;
+  uint16_t sequence_number;
+  uint16_t size;
+  uint16_t remaining;
+  uint16_t failed;
+  uint8_t first_error;
+};
+
+static std::vector<Write_batch> write_batches;
+static uint16_t last_batch_id = 0;
+
+// fields read by the MQTT handlers, the parser skips everything else
+static StaticJsonDocument<JSON_OBJECT_SIZE(4)> request_filter;
+static StaticJsonDocument<JSON_OBJECT_SIZE(5) + JSON_ARRAY_SIZE(1) + JSON_OBJECT_SIZE(3)> set_value_filter;
+static StaticJsonDocument<JSON_OBJECT_SIZE(2)> update_fw_filter;
+static StaticJsonDocument<JSON_OBJECT_SIZE(1)> sequence_filter;
+
+// SET_VALUE with the largest batch, ids and values up to ~30 characters each
+static StaticJsonDocument<
+  JSON_OBJECT_SIZE(5) + JSON_ARRAY_SIZE(Poller::max_writes) + Poller::max_writes * (JSON_OBJECT_SIZE(3) + 96) + 128
+> set_value_json;
+
+static void build_filters();
+static void handle_request(const char* const payload, const size_t length);
+static void handle_set_config(const char* const payload, const size_t length);
+static bool apply_config(const JsonObject& json_config);
+static void handle_set_value(const char* const payload, const size_t length);
+static void handle_update_fw(const char* const payload, const size_t length);
+static bool parse_payload(
+  JsonDocument& json,
+  const char* const payload,
+  const size_t length,
+  const JsonDocument& filter
+);
+static void write_result_details(char* const buffer, const size_t size, const uint8_t result);
+static bool make_write_command(
+  const JsonObject& entry,
+  const uint16_t sequence_number,
+  Command& command,
+  std::string& error
+);
+static void queue_write_batch(const JsonArray& entries, const uint16_t sequence_number);
+
+void MQTT_handlers::setup(Poller* const poller, void (*reserve_buffers)())
+{
+  ::poller = poller;
+  ::reserve_buffers = reserve_buffers;
+
+  write_batches.reserve(Poller::max_writes);
+  build_filters();
+}
+
+// Route the inbound topics of the module to their handlers, the topics are built once
+// per connection
+void MQTT_handlers::connect(MQTT_client* const mqtt_client, FW_updater* const fw_updater, const String& module_mac)
+{
+  ::mqtt_client = mqtt_client;
+  ::fw_updater = fw_updater;
+
+  LOG("Subscribing to ALL_MODULES ...");
+  mqtt_client->route("ALL_MODULES", handle_request);
+  LOG("Subscribing to " + module_mac + "/SET_CONFIG ...");
+  mqtt_client->route((module_mac + "/SET_CONFIG").c_str(), handle_set_config, 2u);
+  LOG("Subscribing to " + module_mac + "/SET_VALUE ...");
+  mqtt_client->route((module_mac + "/SET_VALUE").c_str(), handle_set_value, 2u);
+  LOG("Subscribing to " + module_mac + "/UPDATE_FW ...");
+  mqtt_client->route((module_mac + "/UPDATE_FW").c_str(), handle_update_fw, 2u);
+  LOG("Subscribing to " + module_mac + "/REQUEST ...");
+  mqtt_client->route((module_mac + "/REQUEST").c_str(), handle_request, 2u);
+}
+
+const Device_registry& MQTT_handlers::device_registry()
+{
+  return ::device_registry;
+}
+
+uint32_t MQTT_handlers::config_generation()
+{
+  return ::config_generation;
+}
+
+MQTT_client::Encoding MQTT_handlers::value_encoding()
+{
+  return ::value_encoding;
+}
+
+// Publish REQUEST_RESULT of the commands finished by the poller
+void MQTT_handlers::publish_results()
+{
+  Command_result command_result;
+
+  while (poller->results.pop(command_result))
+  {
+    const uint16_t sequence_number = command_result.sequence_number;
+    uint8_t result = command_result.result;
+    char details[96];
+    size_t length = 0;
+
+    // batch ids start at 1, single writes and stops carry 0 and match none
+    std::vector<Write_batch>::iterator batch = write_batches.begin();
+    while (batch != write_batches.end() && batch->id != command_result.batch_id)
+      ++batch;
+
+    if (batch != write_batches.end())
+    {
+      if (result != Modbus_RTU::success && batch->failed++ == 0)
+        batch->first_error = result;
+
+      // published once all writes of the batch are finished
+      if (--batch->remaining > 0)
+        continue;
+
+      result = batch->failed > 0 ? batch->first_error : Modbus_RTU::success;
+
+      if (batch->failed > 0)
+        length = snprintf(details, sizeof(details), "%u of %u writes failed, first: ", batch->failed, batch->size);
+
+      write_batches.erase(batch);
+    }
+
+    LOG(result == Modbus_RTU::success ? "\t result: ok" : "\t result: error");
+
+    write_result_details(details + length, sizeof(details) - length, result);
+
+    mqtt_client->publish_request_result(
+      sequence_number, result == Modbus_RTU::success, details, command_result.latency_us
+    );
+  }
+}
+
+// Details of the result into the given buffer, no String is built on this path
+static void write_result_details(char* const buffer, const size_t size, const uint8_t result)
+{
+  const char* text;
+
+  if (result == Modbus_RTU::success)
+    text = "";
+  else if (result == Poller::stale_config)
+    text = "Error: device not configured";
+  else if (result == Poller::queue_full)
+    text = "Error: Modbus queue full";
+  else if (result == Poller::cancelled)
+    text = "Error: cancelled by stop";
+  else
+  {
+    LOGF("Error code: %u\n", result);
+    snprintf(buffer, size, "Error code: %u", result);
+    return;
+  }
+
+  snprintf(buffer, size, "%s", text);
+}
+
+// Fields of the handlers below, built once
+static void build_filters()
+{
+  request_filter["request"] = true;
+  request_filter["sequence_number"] = true;
+  request_filter["verify"] = true;
+  request_filter["encoding"] = true;
+
+  set_value_filter["sequence_number"] = true;
+  set_value_filter["device_id"] = true;
+  set_value_filter["datapoint"] = true;
+  set_value_filter["value"] = true;
+
+  // the first element of the filter applies to every batch entry
+  set_value_filter["values"][0]["device_id"] = true;
+  set_value_filter["values"][0]["datapoint"] = true;
+  set_value_filter["values"][0]["value"] = true;
+
+  update_fw_filter["version"] = true;
+  update_fw_filter["sequence_number"] = true;
+
+  sequence_filter["sequence_number"] = true;
+}
+
+// Parse the filtered fields of the payload, false on a JSON error
+static bool parse_payload(
+  JsonDocument& json,
+  const char* const payload,
+  const size_t length,
+  const JsonDocument& filter
+) {
+  const DeserializationError json_err = deserializeJson(json, payload, length, DeserializationOption::Filter(filter));
+
+  if (json_err) 
+  {
+    LOGF("JSON error: %s\n", json_err.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+// REQUEST of this module or ALL_MODULES
+static void handle_request(const char* const payload, const size_t length)
+{
+  // stop latency is reported from here on, including the time in the command queue
+  const uint32_t received_us = micros();
+
+  LOGF("Received request: %.*s\n", int(length), payload);
+
+  StaticJsonDocument<JSON_OBJECT_SIZE(4) + 128> payload_json;
+
+  if (!parse_payload(payload_json, payload, length, request_filter))
+    return;
+
+  const char* request = payload_json["request"];
+
+  if (request != nullptr) 
+  {
+    if (strcmp(request, "module_discovery") == 0)
+      mqtt_client->publish_module_id();
+    else if (strcmp(request, "stop") == 0)
+    {
+      const uint16_t sequence_number = payload_json["sequence_number"];
+
+      LOG("Switching to standby mode");
+      // stop all motors using DC breaks and switch to standy mode,
+      // result is published once the poller finished all writes
+      poller->standby_mode = true;
+
+      Command command;
+      command.type = Command::Type::STOP;
+      command.verify = payload_json["verify"] | false;
+      command.sequence_number = sequence_number;
+      command.received_us = received_us;
+
+      if (!poller->commands.push(command))
+        mqtt_client->publish_request_result(sequence_number, false, "Error: command queue full");
+
+      poller->wake();
+    } 
+    else if (strcmp(request, "set_encoding") == 0)
+    {
+      const uint16_t sequence_number = payload_json["sequence_number"];
+      MQTT_client::Encoding encoding;
+
+      if (!MQTT_client::parse_encoding(payload_json["encoding"].as<const char*>(), &encoding))
+      {
+        mqtt_client->publish_request_result(sequence_number, false, "Error: unsupported encoding");
+        return;
+      }
+
+      // result is still sent in the previous encoding, values of the pass in progress are dropped
+      // and reported again by the next scans
+      mqtt_client->publish_request_result(sequence_number, true);
+
+      LOGF("Switching encoding to %s\n", MQTT_client::encoding_name(encoding));
+      value_encoding = encoding;
+      mqtt_client->encoding = encoding;
+      reserve_buffers();
+      poller->resync_values = true;
+    }
+    else if (strcmp(request, "start") == 0)
+    {
+      const uint16_t sequence_number = payload_json["sequence_number"];
+
+      LOG("Switching to active mode");
+      // switch to active mode
+      poller->standby_mode = false;
+
+      mqtt_client->publish_request_result(sequence_number, true);
+    }
+  }
+}
+
+static void handle_set_config(const char* const payload, const size_t length)
+{
+  LOGF("Received SET_CONFIG: %.*s\n", int(length), payload);
+
+  // config MD5 checksum, hashed in place without a copy of the payload
+  MD5::Hasher hasher;
+  char md5_str[MD5::digest_length + 1];
+  hasher.update(payload, length);
+  hasher.finish_digest(md5_str);
+
+  LOGF("Config MD5 checksum: %s\n", md5_str);
+
+  // redeploy of the configuration in effect, the devices keep polling undisturbed
+  if (strcmp(md5_str, config_hash) == 0)
+  {
+    LOG("Configuration unchanged, switching to active mode");
+    poller->standby_mode = false;
+    mqtt_client->publish_config_update(md5_str);
+    return;
+  }
+
+  // configurations grow with the device count and every field is read, so the document
+  // is sized after the payload and not filtered. Most fit in twice the payload, denser ones
+  // are parsed again into a document twice as large up to a bound no payload of this length
+  // exceeds: every value of an object or array takes at least 2 characters and a copied
+  // string is shorter than its quoted text.
+  const size_t max_capacity = JSON_ARRAY_SIZE(length / 2 + 1) + length + 1;
+  bool applied = false;
+
+  for (size_t capacity = 256 + 2 * length; ; capacity = std::min(2 * capacity, max_capacity))
+  {
+    DynamicJsonDocument payload_json(capacity);
+    const DeserializationError json_err = deserializeJson(payload_json, payload, length);
+
+    // capacity 0 means the document could not be allocated at all
+    if (json_err == DeserializationError::NoMemory && capacity < max_capacity && payload_json.capacity() > 0)
+    {
+      LOGF("Configuration does not fit in %u bytes, parsing again\n", unsigned(capacity));
+      continue;
+    }
+
+    if (json_err)
+    {
+      LOGF("JSON error: %s\n", json_err.c_str());
+    }
+    else
+    {
+      applied = apply_config(payload_json.as<JsonObject>());
+    }
+
+    break;
+  }
+
+  // a configuration which was dropped is answered by the hash of the one still in effect,
+  // empty before the first one
+  if (!applied)
+  {
+    mqtt_client->publish_config_update(config_hash);
+    return;
+  }
+
+  memcpy(config_hash, md5_str, sizeof(config_hash));
+  mqtt_client->publish_config_update(md5_str);
+}
+
+// Hand a parsed SET_CONFIG over to the poller, false if it was dropped
+static bool apply_config(const JsonObject& json_config)
+{
+  Device_config poller_config = {};
+  poller_config.generation = config_generation + 1;
+
+  // RS-485 buses, a single bus according to the wiring scheme if none is given
+  for (const JsonObject bus_config : json_config["buses"].as<JsonArray>())
+  {
+    if (poller_config.bus_count == Bus_config::max_buses)
+    {
+      LOG("Too many buses, configuration dropped");
+      return false;
+    }
+
+    Bus_config& bus = poller_config.buses[poller_config.bus_count++];
+    bus.uart = bus_config["uart"] | int(Bus_config::default_uart);
+    bus.rx_pin = bus_config["rx_pin"] | int(Bus_config::default_pin);
+    bus.tx_pin = bus_config["tx_pin"] | int(Bus_config::default_pin);
+    bus.de_pin = bus_config["de_pin"] | int(Bus_config::default_de_pin);
+    bus.re_neg_pin = bus_config["re_neg_pin"] | int(Bus_config::default_re_neg_pin);
+    bus.baud_rate = bus_config["baud_rate"] | uint32_t(Bus_config::default_baud_rate);
+    // response timeout in seconds, fractions allowed
+    bus.response_timeout_ms = bus_config.containsKey("response_timeout")
+      ? bus_config["response_timeout"].as<float>() * 1000
+      : uint32_t(Modbus_RTU::default_response_timeout_ms);
+
+    const char* const parity = bus_config["parity"] | "none";
+
+    if (strcmp(parity, "even") == 0)
+      bus.parity = Modbus_RTU::Parity::EVEN;
+    else if (strcmp(parity, "odd") == 0)
+      bus.parity = Modbus_RTU::Parity::ODD;
+    else if (strcmp(parity, "none") == 0)
+      bus.parity = Modbus_RTU::Parity::NONE;
+    else
+    {
+      LOGF("Invalid parity: %s, configuration dropped\n", parity);
+      return false;
+    }
+
+    for (uint8_t i = 0; i + 1 < poller_config.bus_count; i++)
+    {
+      if (poller_config.buses[i].uart == bus.uart)
+      {
+        LOGF("UART used by two buses: %u, configuration dropped\n", bus.uart);
+        return false;
+      }
+    }
+
+    if (bus.serial() == nullptr)
+    {
+      LOGF("Invalid UART: %u, configuration dropped\n", bus.uart);
+      return false;
+    }
+  }
+
+  if (poller_config.bus_count == 0)
+  {
+    const Bus_config default_bus = {
+      Bus_config::default_uart, Bus_config::default_pin, Bus_config::default_pin,
+      Bus_config::default_de_pin, Bus_config::default_re_neg_pin, Bus_config::default_baud_rate,
+      Modbus_RTU::Parity::NONE, Modbus_RTU::default_response_timeout_ms
+    };
+
+    poller_config.buses[poller_config.bus_count++] = default_bus;
+  }
+
+  // new device set is handed over to the poller, which carries the state of unchanged
+  // drives over to it and deletes the previous one
+  std::vector<H300>* const config_devices = new std::vector<H300>();
+  Device_registry config_registry;
+  config_registry.reserve(json_config.size());
+
+  // create devices according to received configuration
+
+  for (const JsonPair& pair : json_config) 
+  { 
+    const char* const device_id = pair.key().c_str();
+
+    if (strcmp(device_id, "buses") == 0)
+      continue;
+
+    const JsonObject device_config = pair.value().as<JsonObject>();
+    const JsonVariant address = device_config["address"];
+
+    // checked before it is narrowed, a missing address would become the broadcast address 0
+    // and 300 would become 44
+    if (!address.is<unsigned>() || address.as<unsigned>() == Modbus_RTU::broadcast_address
+      || address.as<unsigned>() > Modbus_RTU::max_unit_address)
+    {
+      LOGF("Invalid address of device %s, configuration dropped\n", device_id);
+      delete config_devices;
+      return false;
+    }
+
+    const uint8_t unit_id = address.as<unsigned>();
+    // index into buses, the first bus by default
+    const uint8_t bus_index = device_config["bus"] | 0;
+
+    if (bus_index >= poller_config.bus_count)
+    {
+      LOGF("Invalid bus of device %s, configuration dropped\n", device_id);
+      delete config_devices;
+      return false;
+    }
+
+    // ids are unique, as are the Modbus addresses on one bus
+    const Device_registry::Result registered = config_registry.add(device_id, bus_index, unit_id);
+
+    if (registered != Device_registry::Result::ADDED)
+    {
+      LOGF(registered == Device_registry::Result::DUPLICATE_UNIT
+        ? "Duplicate address of device %s, configuration dropped\n"
+        : "Duplicate device %s, configuration dropped\n", device_id);
+      delete config_devices;
+      return false;
+    }
+
+    // poll rate in seconds, fractions allowed
+    const uint32_t poll_rate_ms = device_config["poll_rate"].as<float>() * 1000;
+
+    LOGF("Creating device with parameters:\n\t id:\t%s\n\t bus:\t%u\n\t unit_id:\t%u\n\t poll_rate_ms:\t%u\n",
+      device_id, bus_index, unit_id, poll_rate_ms);
+
+    config_devices->emplace_back(bus_index, device_id, unit_id, poll_rate_ms);
+    H300& device = config_devices->back();
+
+    // report-by-exception, deadbands in datapoint units and full update interval in seconds
+    for (const JsonPair& deadband : device_config["deadbands"].as<JsonObject>())
+    {
+      const Datapoint* const datapoint = Datapoint::find(deadband.key().c_str());
+
+      if (datapoint != nullptr)
+        device.deadbands[datapoint - Datapoints::table] = datapoint->raw_delta(deadband.value().as<float>());
+    }
+
+    if (device_config.containsKey("snapshot_interval"))
+      device.snapshot_interval = device_config["snapshot_interval"].as<float>() * 1000;
+
+    // cached configuration registers are read again after this interval in seconds
+    if (device_config.containsKey("revalidate_interval"))
+      device.revalidate_interval = device_config["revalidate_interval"].as<float>() * 1000;
+
+    // per-datapoint poll rate in seconds and enable flag, the rest follows the device poll_rate
+    device.enabled_datapoints = Datapoints::readable_mask();
+
+    for (const JsonPair& setting : device_config["datapoints"].as<JsonObject>())
+    {
+      const Datapoint* const datapoint = Datapoint::find(setting.key().c_str());
+
+      if (datapoint == nullptr || !datapoint->readable)
+        continue;
+
+      const uint8_t index = datapoint - Datapoints::table;
+      const JsonObject datapoint_config = setting.value().as<JsonObject>();
+
+      if (datapoint_config.containsKey("poll_rate"))
+        device.poll_rates[index] = datapoint_config["poll_rate"].as<float>() * 1000;
+
+      if (!(datapoint_config["enabled"] | true))
+        device.enabled_datapoints &= ~(1u << index);
+    }
+  }
+
+  poller_config.devices = config_devices;
+
+  if (!poller->configs.push(poller_config))
+  {
+    LOG("Configuration queue full, configuration dropped");
+    delete config_devices;
+    return false;
+  }
+
+  config_generation++;
+  device_registry.swap(config_registry);
+
+  // size the VALUE_UPDATE buffers after the new device count
+  reserve_buffers();
+  poller->wake();
+
+  LOG("Switching to active mode");
+  // switch to active mode
+  poller->standby_mode = false;
+  
+  LOGF("Actual device count: %u\n", device_registry.size());
+
+  return true;
+}
+
+static void handle_set_value(const char* const payload, const size_t length)
+{
+  LOGF("Received SET_VALUE: %.*s\n", int(length), payload);
+
+  if (!parse_payload(set_value_json, payload, length, set_value_filter))
+  {
+    // e.g. a batch larger than the document, answered if its sequence number can be read
+    StaticJsonDocument<JSON_OBJECT_SIZE(1) + 32> sequence_json;
+
+    if (parse_payload(sequence_json, payload, length, sequence_filter) && sequence_json.containsKey("sequence_number"))
+    {
+      const uint16_t sequence_number = sequence_json["sequence_number"];
+      mqtt_client->publish_request_result(sequence_number, false, "Error: invalid message");
+    }
+
+    return;
+  }
+
+  const uint16_t sequence_number = set_value_json["sequence_number"];
+  JsonArray entries = set_value_json["values"];
+
+  // batch of writes, possibly across devices
+  if (!entries.isNull())
+  {
+    queue_write_batch(entries, sequence_number);
+    return;
+  }
+
+  Command command;
+  std::string error_msg;
+
+  if (!make_write_command(set_value_json.as<JsonObject>(), sequence_number, command, error_msg))
+  {
+    LOGF("\t%s\n", error_msg.c_str());
+    mqtt_client->publish_request_result(sequence_number, false, error_msg.c_str());
+    return;
+  }
+
+  // hand the write over to the poller, result is published once it is finished
+  if (!poller->commands.push(command))
+  {
+    error_msg = "Error: command queue full";
+    LOGF("\t%s\n", error_msg.c_str());
+    mqtt_client->publish_request_result(sequence_number, false, error_msg.c_str());
+  }
+
+  poller->wake();
+}
+
+static void handle_update_fw(const char* const payload, const size_t length)
+{
+  LOGF("Received UPDATE_FW: %.*s\n", int(length), payload);
+
+  StaticJsonDocument<JSON_OBJECT_SIZE(2) + 96> payload_json;
+
+  if (!parse_payload(payload_json, payload, length, update_fw_filter))
+    return;
+
+  const char* version = payload_json["version"];
+  const uint16_t sequence_number = payload_json["sequence_number"];
+
+  LOGF("Updating firmware to version: %s\n", version);
+  bool result = fw_updater->update(version);
+  LOG(result ? "\t result: ok" : "\t result: error");
+  
+  mqtt_client->publish_request_result(sequence_number, result);
+}
+
+// Write command of one SET_VALUE entry, false with the error message if it cannot be written
+static bool make_write_command(
+  const JsonObject& entry,
+  const uint16_t sequence_number,
+  Command& command,
+  std::string& error
+) {
+  const char* device_id = entry["device_id"];
+  const char* datapoint = entry["datapoint"];
+  const char* value = entry["value"];
+
+  LOGF("Setting value:\n\t device_id: %s\n\t datapoint: %s\n\t value: %s\n", device_id, datapoint, value);
+
+  const Datapoint* const target = Datapoint::find(datapoint);
+
+  if (target == nullptr || !target->writable)
+  {
+    error = "Error: unrecognized datapoint";
+    return false;
+  }
+
+  uint16_t raw = 0;
+
+  if (!target->encode(value, &raw))
+  {
+    error = "Error: invalid value";
+    return false;
+  }
+
+  // find the given device by its id
+  const uint16_t device_index = device_registry.find(device_id);
+
+  if (device_index == Device_registry::not_found)
+  {
+    error = "Error: unknown device";
+    return false;
+  }
+
+  command.type = Command::Type::WRITE;
+  command.batch_follows = false;
+  command.generation = config_generation;
+  command.device_index = device_index;
+  command.register_addr = target->register_addr;
+  command.value = raw;
+  command.sequence_number = sequence_number;
+  command.batch_id = 0;
+  return true;
+}
+
+// Queue all writes of a batched SET_VALUE or none of them. The poller holds the writes
+// back until the last one arrives, so that adjacent registers of a device share a frame.
+static void queue_write_batch(const JsonArray& entries, const uint16_t sequence_number)
+{
+  Command commands[Poller::max_writes];
+  const size_t count = entries.size();
+  std::string error_msg;
+
+  if (count == 0 || count > Poller::max_writes)
+    error_msg = (String("Error: batch must have 1 to ") + Poller::max_writes + " values").c_str();
+
+  for (size_t i = 0; error_msg.empty() && i < count; i++)
+  {
+    if (!make_write_command(entries[i].as<JsonObject>(), sequence_number, commands[i], error_msg))
+      break;
+
+    // every register once, otherwise the earlier value would be superseded
+    for (size_t j = 0; j < i; j++)
+      if (commands[j].device_index == commands[i].device_index
+        && commands[j].register_addr == commands[i].register_addr)
+        error_msg = "Error: duplicate datapoint";
+
+    commands[i].batch_follows = i + 1 < count;
+  }
+
+  // the poller only takes commands out, so the free space cannot shrink meanwhile
+  if (error_msg.empty() && poller->commands.capacity() - poller->commands.size() < count)
+    error_msg = "Error: command queue full";
+
+  if (!error_msg.empty())
+  {
+    LOGF("\t%s\n", error_msg.c_str());
+    mqtt_client->publish_request_result(sequence_number, false, error_msg.c_str());
+    return;
+  }
+
+  // 0 marks a single write
+  if (++last_batch_id == 0)
+    last_batch_id = 1;
+
+  const Write_batch batch = {
+    last_batch_id, sequence_number, uint16_t(count), uint16_t(count), 0, Modbus_RTU::success
+  };
+  write_batches.push_back(batch);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    commands[i].batch_id = batch.id;
+    poller->commands.push(commands[i]);
+  }
+
+  poller->wake();
+}
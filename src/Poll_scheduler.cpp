@@ -0,0 +1,133 @@
+#include "Poll_scheduler.hpp"
+#include <map>
+#include <utility>
+
+// Schedule all devices, first poll of devices with the same period is staggered over it
+void Poll_scheduler::reset(const std::vector<uint32_t>& periods_ms, const uint32_t now)
+{
+  reschedule(periods_ms, std::vector<uint16_t>(periods_ms.size(), uint16_t(new_device)), now);
+  stats = {};
+}
+
+// Schedule a changed device set. Devices kept from the previous set (their previous index,
+// new_device otherwise) with the same period keep their cadence, the others are staggered
+// over their period as on reset.
+void Poll_scheduler::reschedule(
+  const std::vector<uint32_t>& periods_ms,
+  const std::vector<uint16_t>& previous_indices,
+  const uint32_t now
+) {
+  // due time of every previous device
+  std::vector<uint32_t> previous_due(periods.size(), now);
+
+  for (; !queue.empty(); queue.pop())
+    previous_due[queue.top().device_index] = queue.top().due;
+
+  const std::vector<uint32_t> previous_periods = std::move(periods);
+  const std::vector<uint32_t> previous_last_polled = std::move(last_polled);
+  const std::vector<bool> previous_polled = std::move(polled);
+
+  std::vector<Entry> entries;
+  entries.reserve(periods_ms.size());
+
+  periods.assign(periods_ms.size(), 0);
+  last_polled.assign(periods_ms.size(), now);
+  polled.assign(periods_ms.size(), false);
+
+  std::map<uint32_t, uint16_t> rate_count;
+  std::map<uint32_t, uint16_t> rate_position;
+  std::vector<bool> kept(periods_ms.size(), false);
+
+  for (size_t i = 0; i < periods_ms.size(); i++)
+  {
+    const uint16_t previous = previous_indices[i];
+
+    periods[i] = periods_ms[i] < min_period_ms ? min_period_ms : periods_ms[i];
+    kept[i] = previous < previous_periods.size() && previous_periods[previous] == periods[i];
+
+    if (kept[i])
+    {
+      const Entry entry = { previous_due[previous], uint16_t(i) };
+      entries.push_back(entry);
+      last_polled[i] = previous_last_polled[previous];
+      polled[i] = previous_polled[previous];
+    }
+    else
+      rate_count[periods[i]]++;
+  }
+
+  for (size_t i = 0; i < periods.size(); i++)
+  {
+    if (kept[i])
+      continue;
+
+    const uint32_t offset = uint64_t(periods[i]) * rate_position[periods[i]]++ / rate_count[periods[i]];
+    const Entry entry = { now + offset, uint16_t(i) };
+    entries.push_back(entry);
+  }
+
+  queue = std::priority_queue<Entry, std::vector<Entry>, Later>(Later(), std::move(entries));
+}
+
+// Take the earliest device if it is due and schedule its next poll
+bool Poll_scheduler::pop_due(const uint32_t now, uint16_t* const device_index)
+{
+  if (queue.empty() || int32_t(now - queue.top().due) < 0)
+    return false;
+
+  Entry entry = queue.top();
+  queue.pop();
+
+  const uint16_t index = entry.device_index;
+  const uint32_t period = periods[index];
+  const uint32_t lateness = now - entry.due;
+
+  stats.polls++;
+  stats.total_lateness_ms += lateness;
+
+  if (lateness > stats.max_lateness_ms)
+    stats.max_lateness_ms = lateness;
+
+  if (polled[index])
+  {
+    const uint32_t interval = now - last_polled[index];
+    const uint32_t jitter = interval > period ? interval - period : period - interval;
+
+    if (jitter > stats.max_jitter_ms)
+      stats.max_jitter_ms = jitter;
+  }
+
+  polled[index] = true;
+  last_polled[index] = now;
+
+  // keep the cadence of the device, periods which already passed are skipped
+  entry.due += period;
+  while (int32_t(now - entry.due) >= 0)
+  {
+    entry.due += period;
+    stats.skipped++;
+  }
+
+  queue.push(entry);
+
+  *device_index = index;
+  return true;
+}
+
+uint32_t Poll_scheduler::until_due(const uint32_t now) const
+{
+  if (queue.empty())
+    return UINT32_MAX;
+
+  const int32_t remaining = int32_t(queue.top().due - now);
+
+  return remaining > 0 ? remaining : 0;
+}
+
+Poll_scheduler::Stats Poll_scheduler::take_stats()
+{
+  const Stats taken = stats;
+  stats = {};
+
+  return taken;
+}
@@ -0,0 +1,899 @@
+#include "Poller.hpp"
+#include "Device_registry.hpp"
+
+Poller::Lane::Lane()
+  : bus(nullptr), planner(Modbus_RTU::timing(Bus_config::default_baud_rate), H300::response_delay_us),
+    scanned_device(nullptr), probing(false), scan_started_us(0), stats()
+{
+}
+
+Poller::Poller(const Read_planner& planner, const uint32_t idle_delay_ms)
+  : standby_mode(false), revalidate_caches(false), resync_values(false), planner(planner),
+    idle_delay_ms(idle_delay_ms), task_handle(nullptr), devices(nullptr), generation(0), lane_count(0), stats_since(millis()),
+    pass_samples(0), pass_started(0), device_stats_generation(0), device_stats_ready(false), write_order(0), batch_open(false)
+{
+  for (Stop_request& stop_request : stop_requests)
+  {
+    stop_request.poller = this;
+    stop_request.pending = 0;
+  }
+
+  for (Write_request& write_request : write_requests)
+  {
+    write_request.poller = this;
+    write_request.pending = false;
+  }
+}
+
+// Run the poller on its own task pinned to the given core
+bool Poller::start(const BaseType_t core)
+{
+  return xTaskCreatePinnedToCore(task, "modbus_poller", 4096, this, 1, &task_handle, core) == pdPASS;
+}
+
+// Wake the poller up from waiting for the next due device, e.g. after queuing a command
+void Poller::wake()
+{
+  if (task_handle != nullptr)
+    xTaskNotifyGive(task_handle);
+}
+
+void Poller::task(void* parameter)
+{
+  Poller* const poller = static_cast<Poller*>(parameter);
+
+  for (;;)
+  {
+    const uint32_t idle_ms = poller->poll();
+
+    // sleep until the next device is due or a command arrives,
+    // while a transaction is in progress just let the other tasks run
+    ulTaskNotifyTake(pdTRUE, idle_ms > 0 ? pdMS_TO_TICKS(idle_ms) : 1);
+  }
+}
+
+// One iteration of the poller, returns time in ms the poller may sleep
+uint32_t Poller::poll()
+{
+  apply_configs();
+
+  if (revalidate_caches.exchange(false) && devices != nullptr)
+  {
+    for (H300& device : *devices)
+      device.invalidate_cache();
+  }
+
+  if (resync_values.exchange(false) && devices != nullptr)
+  {
+    for (H300& device : *devices)
+      device.force_snapshot();
+  }
+
+  execute_commands();
+
+  const uint32_t now = millis();
+
+  if (now - stats_since >= stats_interval_ms)
+  {
+    push_stats();
+    stats_since = now;
+  }
+
+  uint32_t idle_ms = idle_delay_ms;
+  bool pass_finished = true;
+
+  for (uint8_t i = 0; i < lane_count; i++)
+  {
+    Lane& lane = lanes[i];
+
+    // writes go ahead of the scan
+    issue_write(i);
+
+    // advance the Modbus transaction in progress, never waits for the bus
+    lane.bus->poll();
+
+    const uint32_t lane_idle_ms = lane.bus->idle() ? scan(lane) : 0;
+
+    if (lane_idle_ms < idle_ms)
+      idle_ms = lane_idle_ms;
+
+    if (lane.scanned_device != nullptr)
+      pass_finished = false;
+  }
+
+  // no device is due on any bus now, or a saturated bus kept the pass going for too long
+  if (pass_samples > 0 && (pass_finished || millis() - pass_started >= max_pass_ms))
+    end_pass();
+
+  return idle_ms;
+}
+
+void Poller::apply_configs()
+{
+  Device_config config;
+
+  while (configs.pop(config))
+  {
+    // drop pending reads of the previous devices
+    if (devices != nullptr)
+    {
+      for (H300& device : *devices)
+        if (device.bus_index < lane_count)
+          lanes[device.bus_index].bus->cancel(&device);
+    }
+
+    // buses are opened again only if their settings changed
+    bool reopened[Bus_config::max_buses] = {};
+
+    for (uint8_t i = 0; i < lane_count; i++)
+      if (i >= config.bus_count || lanes[i].config != config.buses[i])
+        close_lane(lanes[i]);
+
+    for (uint8_t i = 0; i < config.bus_count; i++)
+    {
+      if (lanes[i].bus == nullptr)
+      {
+        open_lane(lanes[i], config.buses[i]);
+        reopened[i] = true;
+      }
+    }
+
+    // previous index of every new device which is the same drive on a kept bus
+    std::vector<uint16_t> previous_indices(config.devices->size(), uint16_t(Poll_scheduler::new_device));
+    std::vector<uint16_t> lane_positions;
+    const uint16_t previous_count = devices != nullptr ? devices->size() : 0;
+
+    if (devices != nullptr)
+      map_devices(*config.devices, reopened, previous_indices, lane_positions);
+
+    // writes to a kept drive are carried over, the others did not reach the bus
+    std::vector<uint16_t> new_indices(previous_count, uint16_t(Poll_scheduler::new_device));
+
+    for (uint16_t i = 0; i < previous_indices.size(); i++)
+      if (previous_indices[i] != Poll_scheduler::new_device)
+        new_indices[previous_indices[i]] = i;
+
+    for (Write_request& request : write_requests)
+    {
+      if (!request.pending)
+        continue;
+
+      if (request.generation == generation && new_indices[request.device_index] != Poll_scheduler::new_device)
+      {
+        request.device_index = new_indices[request.device_index];
+        request.generation = config.generation;
+      }
+      else if (!request.issued)
+        finish_write(request, stale_config);
+    }
+
+    delete devices;
+
+    lane_count = config.bus_count;
+    devices = config.devices;
+    generation = config.generation;
+
+    for (uint8_t i = 0; i < lane_count; i++)
+    {
+      lanes[i].device_indices.clear();
+      lanes[i].scanned_device = nullptr;
+      lanes[i].probing = false;
+    }
+
+    for (uint16_t i = 0; i < devices->size(); i++)
+    {
+      H300& device = (*devices)[i];
+
+      // devices of a missing bus are never scanned
+      if (device.bus_index >= lane_count)
+        continue;
+
+      device.attach(*lanes[device.bus_index].bus);
+      lanes[device.bus_index].device_indices.push_back(i);
+    }
+
+    const uint32_t now = millis();
+
+    // kept drives keep their cadence on a kept bus
+    for (uint8_t i = 0; i < lane_count; i++)
+    {
+      std::vector<uint32_t> periods;
+      std::vector<uint16_t> previous_positions;
+      periods.reserve(lanes[i].device_indices.size());
+      previous_positions.reserve(lanes[i].device_indices.size());
+
+      for (const uint16_t device_index : lanes[i].device_indices)
+      {
+        const uint16_t previous = previous_indices[device_index];
+
+        periods.push_back((*devices)[device_index].scan_period());
+        previous_positions.push_back(
+          previous != Poll_scheduler::new_device ? lane_positions[previous] : uint16_t(Poll_scheduler::new_device)
+        );
+      }
+
+      if (reopened[i])
+        lanes[i].scheduler.reset(periods, now);
+      else
+        lanes[i].scheduler.reschedule(periods, previous_positions, now);
+    }
+
+    pass_samples = 0;
+    pass_devices.assign(devices->size(), false);
+  }
+}
+
+// Find the previous device of every new device: the same device id, unit and bus, where
+// the bus was kept open. The new device takes over its runtime state. Lane positions
+// are the previous scheduler indices of the previous devices.
+void Poller::map_devices(
+  std::vector<H300>& config_devices,
+  const bool* const reopened,
+  std::vector<uint16_t>& previous_indices,
+  std::vector<uint16_t>& lane_positions
+) {
+  // previous devices were registered without conflicts, registry index is the device index
+  Device_registry previous_registry;
+  previous_registry.reserve(devices->size());
+  lane_positions.assign(devices->size(), uint16_t(Poll_scheduler::new_device));
+
+  for (const H300& previous : *devices)
+    previous_registry.add(previous.device_id.c_str(), previous.bus_index, previous.unit_id);
+
+  for (uint8_t i = 0; i < lane_count; i++)
+    for (uint16_t position = 0; position < lanes[i].device_indices.size(); position++)
+      lane_positions[lanes[i].device_indices[position]] = position;
+
+  for (uint16_t i = 0; i < config_devices.size(); i++)
+  {
+    H300& device = config_devices[i];
+    const uint16_t found = previous_registry.find(device.device_id.c_str());
+
+    if (found == Device_registry::not_found)
+      continue;
+
+    const H300& previous = (*devices)[found];
+
+    if (previous.unit_id != device.unit_id || previous.bus_index != device.bus_index
+      || device.bus_index >= Bus_config::max_buses || reopened[device.bus_index]
+      || lanes[device.bus_index].bus == nullptr || lane_positions[found] == Poll_scheduler::new_device)
+      continue;
+
+    device.take_state(previous);
+    previous_indices[i] = found;
+  }
+}
+
+// Open UART of the bus and plan the reads for its line timing
+void Poller::open_lane(Lane& lane, const Bus_config& config)
+{
+  HardwareSerial* const serial = config.serial();
+
+  lane.config = config;
+  serial->begin(config.baud_rate, config.serial_config(), config.rx_pin, config.tx_pin);
+  lane.bus = new Modbus_RTU(
+    *serial, config.baud_rate, config.de_pin, config.re_neg_pin, config.response_timeout_ms, config.parity
+  );
+
+  lane.planner = Read_planner(Modbus_RTU::timing(config.baud_rate, config.parity), H300::response_delay_us);
+
+  for (uint8_t i = 0; i < planner.register_count(); i++)
+    lane.planner.add_register(planner.register_at(i));
+}
+
+// Close the bus, requests still queued on it are reported as not executed
+void Poller::close_lane(Lane& lane)
+{
+  if (lane.bus == nullptr)
+    return;
+
+  lane.bus->abort(stale_config);
+  delete lane.bus;
+  lane.bus = nullptr;
+
+  lane.config.serial()->end();
+  lane.scanned_device = nullptr;
+}
+
+void Poller::execute_commands()
+{
+  Command command;
+
+  while (commands.pop(command))
+  {
+    if (command.type == Command::Type::STOP)
+    {
+      execute_stop(command);
+      continue;
+    }
+
+    // rest of the batch is being pushed, adjacent registers of it may share a frame
+    batch_open = command.batch_follows;
+
+    if (devices == nullptr || command.generation != generation || command.device_index >= devices->size()
+      || (*devices)[command.device_index].bus_index >= lane_count)
+    {
+      push_result(command.sequence_number, command.batch_id, stale_config);
+      continue;
+    }
+
+    queue_write(command);
+  }
+}
+
+// Coalesce the write with a waiting one to the same register or take a free slot
+void Poller::queue_write(const Command& command)
+{
+  Write_request* free_request = nullptr;
+
+  for (Write_request& request : write_requests)
+  {
+    if (!request.pending)
+    {
+      if (free_request == nullptr)
+        free_request = &request;
+
+      continue;
+    }
+
+    if (request.issued || request.device_index != command.device_index
+      || request.register_addr != command.register_addr)
+      continue;
+
+    // latest value wins, the superseded command gets the result of the write. Sequence
+    // numbers usually follow each other, so a burst of writes takes a single run.
+    Sequence_run* const last = request.superseded_count > 0
+      ? &request.superseded[request.superseded_count - 1] : nullptr;
+
+    if (last != nullptr && uint16_t(last->first + last->count) == request.sequence_number
+      && last->batch_id == request.batch_id)
+      last->count++;
+    else if (request.superseded_count < max_superseded)
+    {
+      const Sequence_run run = { request.sequence_number, 1, request.batch_id };
+      request.superseded[request.superseded_count++] = run;
+    }
+    else
+    {
+      // commands already accepted keep waiting for the write
+      push_result(command.sequence_number, command.batch_id, queue_full);
+      return;
+    }
+
+    request.sequence_number = command.sequence_number;
+    request.batch_id = command.batch_id;
+    request.value = command.value;
+    return;
+  }
+
+  if (free_request == nullptr)
+  {
+    push_result(command.sequence_number, command.batch_id, queue_full);
+    return;
+  }
+
+  free_request->pending = true;
+  free_request->issued = false;
+  free_request->order = write_order++;
+  free_request->generation = generation;
+  free_request->device_index = command.device_index;
+  free_request->register_addr = command.register_addr;
+  free_request->value = command.value;
+  free_request->sequence_number = command.sequence_number;
+  free_request->batch_id = command.batch_id;
+  free_request->superseded_count = 0;
+}
+
+// Hand the oldest waiting write of the bus over to it, one write at a time
+// so that writes waiting in the poller can still be coalesced
+void Poller::issue_write(const uint8_t lane_index)
+{
+  if (batch_open || lanes[lane_index].bus->writes_pending())
+    return;
+
+  Write_request* oldest = nullptr;
+
+  for (Write_request& request : write_requests)
+  {
+    if (!request.pending || request.issued || (*devices)[request.device_index].bus_index != lane_index)
+      continue;
+
+    if (oldest == nullptr || int32_t(request.order - oldest->order) < 0)
+      oldest = &request;
+  }
+
+  if (oldest == nullptr)
+    return;
+
+  // waiting writes of adjacent registers of the device go out in one frame
+  Write_request* first = oldest;
+  Write_request* last = oldest;
+  uint8_t count = 1;
+  bool extended = true;
+
+  oldest->next = nullptr;
+
+  while (extended && count < Modbus_RTU::max_registers)
+  {
+    extended = false;
+
+    for (Write_request& request : write_requests)
+    {
+      if (!request.pending || request.issued || request.device_index != oldest->device_index)
+        continue;
+
+      if (request.register_addr == last->register_addr + 1)
+      {
+        request.next = nullptr;
+        last->next = &request;
+        last = &request;
+      }
+      else if (request.register_addr + 1 == first->register_addr)
+      {
+        request.next = first;
+        first = &request;
+      }
+      else
+        continue;
+
+      count++;
+      extended = true;
+      break;
+    }
+  }
+
+  const H300& device = (*devices)[oldest->device_index];
+  bool queued;
+
+  if (count == 1)
+    queued = device.write_value(oldest->register_addr, oldest->value, write_callback, oldest);
+  else
+  {
+    uint16_t values[Modbus_RTU::max_registers];
+    uint8_t i = 0;
+
+    for (const Write_request* request = first; request != nullptr; request = request->next)
+      values[i++] = request->value;
+
+    queued = device.write_values(first->register_addr, count, values, write_callback, first);
+  }
+
+  if (queued)
+    for (Write_request* request = first; request != nullptr; request = request->next)
+      request->issued = true;
+}
+
+void Poller::finish_write(Write_request& request, const uint8_t result)
+{
+  for (uint8_t i = 0; i < request.superseded_count; i++)
+    for (uint16_t j = 0; j < request.superseded[i].count; j++)
+      push_result(request.superseded[i].first + j, request.superseded[i].batch_id, result);
+
+  push_result(request.sequence_number, request.batch_id, result);
+  request.pending = false;
+}
+
+// Stop all motors using DC breaks by a single broadcast frame on every bus. With verify
+// the motion state of every device is read back and a device still running gets its own
+// stop write. Result is pushed once all transactions are finished, along with the time
+// it took since the request was received.
+void Poller::execute_stop(const Command& command)
+{
+  Stop_request* stop_request = nullptr;
+
+  for (Stop_request& pending : stop_requests)
+  {
+    if (pending.pending == 0)
+    {
+      stop_request = &pending;
+      break;
+    }
+  }
+
+  if (stop_request == nullptr)
+  {
+    push_result(command.sequence_number, 0, queue_full);
+    return;
+  }
+
+  stop_request->sequence_number = command.sequence_number;
+  stop_request->result = Modbus_RTU::success;
+  stop_request->verify = command.verify;
+  stop_request->generation = generation;
+  stop_request->received_us = command.received_us;
+
+  // writes waiting for the bus must not start the motors again
+  for (Write_request& request : write_requests)
+    if (request.pending && !request.issued)
+      finish_write(request, cancelled);
+
+  // queued behind a write already handed over to the bus, so the order of writes is kept
+  for (uint8_t i = 0; i < lane_count; i++)
+  {
+    if (lanes[i].bus->write_single_register(
+      Modbus_RTU::broadcast_address, H300::set_motion_register, H300::motion_break, stop_callback, stop_request, i
+    ))
+      stop_request->pending++;
+    else
+      stop_request->result = queue_full;
+  }
+
+  if (stop_request->pending == 0)
+    finish_stop(*stop_request);
+}
+
+// Read back the motion state of the next device of the bus. Devices are read one after
+// another, so that verifying a large bus does not fill the transaction queue. Offline
+// devices are skipped, each of them would only hold the bus for the full timeout.
+void Poller::verify_next(Stop_request& stop_request, const uint8_t lane_index)
+{
+  const std::vector<uint16_t>& device_indices = lanes[lane_index].device_indices;
+  uint16_t& position = stop_request.verify_positions[lane_index];
+
+  while (position < device_indices.size())
+  {
+    const uint16_t device_index = device_indices[position++];
+
+    if ((*devices)[device_index].health() == H300::Health::OFFLINE)
+      continue;
+
+    if ((*devices)[device_index].read_value(H300::get_motion_register, stop_callback, &stop_request, device_index))
+    {
+      stop_request.pending++;
+      return;
+    }
+
+    stop_request.result = queue_full;
+  }
+}
+
+void Poller::finish_stop(Stop_request& stop_request)
+{
+  push_result(stop_request.sequence_number, 0, stop_request.result, micros() - stop_request.received_us);
+}
+
+// Scan the devices of one bus, returns time in ms until the next one is due
+uint32_t Poller::scan(Lane& lane)
+{
+  // check if any device is present on the bus and standby mode is off
+  if (lane.device_indices.empty() || standby_mode.load())
+    return idle_delay_ms;
+
+  // wait until all reads of the device being scanned are done
+  if (lane.scanned_device != nullptr)
+  {
+    if (!lane.scanned_device->scan_complete())
+      return 0;
+
+    H300& device = *lane.scanned_device;
+    const uint16_t device_index = lane.scanned_device - devices->data();
+    lane.scanned_device = nullptr;
+
+    // a probe has no values, the next scan of a device back online publishes them
+    if (!lane.probing)
+    {
+      const uint32_t scan_us = micros() - lane.scan_started_us;
+      lane.stats.scans++;
+      lane.stats.scan_total_us += scan_us;
+
+      if (scan_us > lane.stats.scan_max_us)
+        lane.stats.scan_max_us = scan_us;
+
+      if (device.take_offline_report())
+        push_offline(device_index);
+      else
+        push_sample(lane.planner, device_index, device);
+    }
+  }
+
+  // start reading the most overdue device
+  uint16_t lane_index = 0;
+  while (lane.scheduler.pop_due(millis(), &lane_index))
+  {
+    const uint16_t device_index = lane.device_indices[lane_index];
+    H300& device = (*devices)[device_index];
+    const uint32_t now = millis();
+
+    // offline device keeps the bus only for a single read, and ever less often
+    if (device.health() == H300::Health::OFFLINE)
+    {
+      if (device.probe_due(now) && device.start_probe())
+      {
+        lane.scanned_device = &device;
+        lane.probing = true;
+        return 0;
+      }
+
+      continue;
+    }
+
+    device.expire_cache(now);
+    const uint16_t due = device.due_datapoints(now);
+    const uint16_t registers = register_mask(lane.planner, device, due);
+
+    // read registers of the due datapoints in as few transactions as possible
+    if (device.start_scan(lane.planner, registers))
+    {
+      lane.scanned_device = &device;
+      lane.probing = false;
+      lane.scan_started_us = micros();
+      return 0;
+    }
+
+    // every due datapoint is served from the cache, its values are reported without the bus
+    if (due != 0 && registers == 0)
+      push_sample(lane.planner, device_index, device);
+  }
+
+  const uint32_t until_due = lane.scheduler.until_due(millis());
+
+  return until_due < idle_delay_ms ? until_due : idle_delay_ms;
+}
+
+// Map the scanned register values to datapoints and hand them to the MQTT side
+void Poller::push_sample(const Read_planner& lane_planner, const uint16_t device_index, H300& device)
+{
+  Sample sample;
+  sample.generation = generation;
+  sample.device_index = device_index;
+  sample.offline = false;
+  uint16_t valid = 0;
+
+  for (uint8_t i = 0; i < Datapoints::count; i++)
+  {
+    const Datapoint& datapoint = Datapoints::table[i];
+    const int8_t index = lane_planner.index_of(datapoint.register_addr);
+
+    if (!datapoint.readable || index < 0)
+      continue;
+
+    if (device.scan_valid & (1u << index))
+      sample.raw[i] = device.scan_values[index];
+    else if (!device.cache_lookup(datapoint.register_addr, &sample.raw[i]))
+      continue;
+
+    valid |= 1u << i;
+  }
+
+  // datapoints sharing a register with a due one are refreshed as well
+  const uint32_t now = millis();
+  valid &= device.enabled_datapoints;
+  device.mark_polled(valid, now);
+
+  // publish only what changed since the last update
+  sample.valid = device.report_changes(sample.raw, valid, now);
+
+  if (sample.valid == 0)
+    return;
+
+  // sample is dropped if the MQTT side does not keep up, the device then reports all
+  // of its values next time
+  if (push_pass_sample(sample))
+    device.mark_reported(sample.raw, sample.valid, now);
+  else
+    device.force_snapshot();
+}
+
+// Report the device as offline in place of its values, once when it stops answering
+void Poller::push_offline(const uint16_t device_index)
+{
+  Sample sample;
+  sample.generation = generation;
+  sample.device_index = device_index;
+  sample.offline = true;
+  sample.valid = 0;
+
+  push_pass_sample(sample);
+}
+
+// Hand the sample over as part of the pass in progress. A device which is in the pass
+// already is due again before the other buses finished, it starts the next pass.
+bool Poller::push_pass_sample(const Sample& sample)
+{
+  if (pass_devices[sample.device_index] && !end_pass())
+    return false;
+
+  if (!samples.push(sample))
+    return false;
+
+  if (pass_samples++ == 0)
+    pass_started = millis();
+
+  pass_devices[sample.device_index] = true;
+  return true;
+}
+
+// Let the MQTT side publish the values of the pass, false if the marker did not fit
+bool Poller::end_pass()
+{
+  Sample marker;
+  marker.generation = generation;
+  marker.device_index = end_of_pass;
+  marker.offline = false;
+  marker.valid = 0;
+
+  if (!samples.push(marker))
+    return false;
+
+  pass_samples = 0;
+  pass_devices.assign(pass_devices.size(), false);
+  return true;
+}
+
+// Planner register indices of the given datapoints (bit mask of datapoint table indices)
+// which have to be read from the device, cached registers are served without the bus
+uint16_t Poller::register_mask(
+  const Read_planner& lane_planner,
+  const H300& device,
+  const uint16_t datapoints
+) const {
+  uint16_t registers = 0;
+
+  for (uint8_t i = 0; i < Datapoints::count; i++)
+  {
+    const Datapoint& datapoint = Datapoints::table[i];
+    const int8_t index = lane_planner.index_of(datapoint.register_addr);
+
+    if ((datapoints & (1u << i)) && datapoint.readable && index >= 0
+      && !device.cache_lookup(datapoint.register_addr, nullptr))
+      registers |= 1u << index;
+  }
+
+  return registers;
+}
+
+// Scheduling stats of all buses combined
+Poll_scheduler::Stats Poller::take_stats()
+{
+  Poll_scheduler::Stats stats = {};
+
+  for (uint8_t i = 0; i < lane_count; i++)
+  {
+    const Poll_scheduler::Stats lane_stats = lanes[i].scheduler.take_stats();
+
+    stats.polls += lane_stats.polls;
+    stats.skipped += lane_stats.skipped;
+    stats.total_lateness_ms += lane_stats.total_lateness_ms;
+
+    if (lane_stats.max_lateness_ms > stats.max_lateness_ms)
+      stats.max_lateness_ms = lane_stats.max_lateness_ms;
+
+    if (lane_stats.max_jitter_ms > stats.max_jitter_ms)
+      stats.max_jitter_ms = lane_stats.max_jitter_ms;
+  }
+
+  return stats;
+}
+
+// Hand the stats of the interval over to the MQTT side. Device stats are handed over
+// only once the previous ones were taken, until then the devices keep counting.
+void Poller::push_stats()
+{
+  schedule_stats.push(take_stats());
+
+  for (uint8_t i = 0; i < lane_count; i++)
+  {
+    Lane& lane = lanes[i];
+
+    lane.stats.bus_index = i;
+    lane.stats.latency = lane.bus->take_latency_stats();
+    bus_stats.push(lane.stats);
+    lane.stats = Bus_stats();
+  }
+
+  if (devices == nullptr || device_stats_ready.load(std::memory_order_acquire))
+    return;
+
+  // both vectors keep their capacity, so this allocates only when devices are added
+  device_stats.resize(devices->size());
+
+  for (uint16_t i = 0; i < devices->size(); i++)
+  {
+    H300& device = (*devices)[i];
+
+    device_stats[i] = device.stats;
+    device.stats = Device_stats();
+  }
+
+  device_stats_generation = generation;
+  device_stats_ready.store(true, std::memory_order_release);
+}
+
+// Take device stats of the last interval, indexed as the devices of the given generation.
+// Called from the MQTT side, the vector is swapped with the one of the poller.
+bool Poller::take_device_stats(std::vector<Device_stats>& stats, uint32_t* const stats_generation)
+{
+  if (!device_stats_ready.load(std::memory_order_acquire))
+    return false;
+
+  stats.swap(device_stats);
+  *stats_generation = device_stats_generation;
+  device_stats_ready.store(false, std::memory_order_release);
+  return true;
+}
+
+void Poller::push_result(
+  const uint16_t sequence_number,
+  const uint16_t batch_id,
+  const uint8_t result,
+  const uint32_t latency_us
+) {
+  const Command_result command_result = { sequence_number, batch_id, result, latency_us };
+
+  results.push(command_result);
+}
+
+void Poller::write_callback(void* context, const Modbus_RTU::Transaction& transaction)
+{
+  Write_request* request = static_cast<Write_request*>(context);
+  Poller* const poller = request->poller;
+
+  // one transaction for all registers of the frame
+  if (request->generation == poller->generation)
+    (*poller->devices)[request->device_index].record(transaction);
+
+  // every register written by the frame, in register order
+  while (request != nullptr)
+  {
+    // write may outlive its configuration
+    if (request->generation == poller->generation)
+    {
+      H300& device = (*poller->devices)[request->device_index];
+
+      if (transaction.result == Modbus_RTU::success)
+        device.cache_store(request->register_addr, request->value, millis());
+      else
+        device.invalidate_cache(request->register_addr);
+    }
+
+    Write_request* const next = request->next;
+    poller->finish_write(*request, transaction.result);
+    request = next;
+  }
+}
+
+void Poller::stop_callback(void* context, const Modbus_RTU::Transaction& transaction)
+{
+  Stop_request* const stop_request = static_cast<Stop_request*>(context);
+  Poller* const poller = stop_request->poller;
+
+  if (transaction.result != Modbus_RTU::success)
+    stop_request->result = transaction.result;
+
+  // tag of a unicast is the device index
+  if (transaction.unit_id != Modbus_RTU::broadcast_address && stop_request->generation == poller->generation)
+    (*poller->devices)[transaction.tag].record(transaction);
+
+  // devices may have changed since the stop was issued
+  const bool verify = stop_request->verify && stop_request->generation == poller->generation;
+
+  if (verify && transaction.unit_id == Modbus_RTU::broadcast_address)
+  {
+    // tag of the broadcast is the bus index, read back motion state of its devices
+    if (transaction.result == Modbus_RTU::success)
+    {
+      stop_request->verify_positions[transaction.tag] = 0;
+      poller->verify_next(*stop_request, transaction.tag);
+    }
+  }
+  else if (verify && transaction.function == Modbus_RTU::read_holding_registers_function)
+  {
+    const H300& device = (*poller->devices)[transaction.tag];
+
+    // the device missed the broadcast, stop it on its own
+    if (transaction.result == Modbus_RTU::success && transaction.values[0] != H300::motion_stopped)
+    {
+      if (device.write_value(
+        H300::set_motion_register, H300::motion_break, stop_callback, stop_request, transaction.tag
+      ))
+        stop_request->pending++;
+      else
+        stop_request->result = queue_full;
+    }
+
+    poller->verify_next(*stop_request, device.bus_index);
+  }
+
+  if (--stop_request->pending == 0)
+    poller->finish_stop(*stop_request);
+}
@@ -0,0 +1,114 @@
+#include "Read_planner.hpp"
+
+// RTU request (address, function, start, count, CRC) and fixed part of the response
+static constexpr uint32_t request_bytes = 8;
+static constexpr uint32_t response_header_bytes = 5;
+
+Read_planner::Read_planner(const Modbus_RTU::Timing& timing, const uint32_t response_delay_us)
+  : registers_count(0), ranges_count(0), char_us(timing.char_us)
+{
+  frame_overhead_us =
+    (request_bytes + response_header_bytes) * char_us + 2 * timing.silence_us + response_delay_us;
+}
+
+// Add register to the scanned set (kept in ascending order) and plan the reads again
+bool Read_planner::add_register(const uint16_t register_addr)
+{
+  if (index_of(register_addr) >= 0)
+    return true;
+
+  if (registers_count == max_registers)
+    return false;
+
+  uint8_t i = registers_count++;
+
+  for (; i > 0 && registers[i - 1] > register_addr; i--)
+    registers[i] = registers[i - 1];
+
+  registers[i] = register_addr;
+
+  plan();
+  return true;
+}
+
+void Read_planner::plan()
+{
+  ranges_count = 0;
+
+  for (uint8_t i = 0; i < registers_count; i++)
+  {
+    const uint16_t register_addr = registers[i];
+
+    if (ranges_count > 0)
+    {
+      Range& last = ranges[ranges_count - 1];
+      const uint32_t span = uint32_t(register_addr) - last.start + 1;
+      const uint32_t gap = uint32_t(register_addr) - last.start - last.count;
+
+      // extend the previous range if reading the gap is cheaper than a new frame
+      if (span <= max_span && 2 * gap * char_us <= frame_overhead_us)
+      {
+        last.count = span;
+        continue;
+      }
+    }
+
+    ranges[ranges_count].start = register_addr;
+    ranges[ranges_count].count = 1;
+    ranges_count++;
+  }
+}
+
+int8_t Read_planner::index_of(const uint16_t register_addr) const
+{
+  for (uint8_t i = 0; i < registers_count; i++)
+    if (registers[i] == register_addr)
+      return i;
+
+  return -1;
+}
+
+// Fallback for drives that reject a merged read (e.g. a gap register is not mapped):
+// the range is replaced by single register reads of the requested registers.
+void Read_planner::split_range(const uint8_t index)
+{
+  if (index >= ranges_count || ranges[index].count == 1)
+    return;
+
+  const Range merged = ranges[index];
+  Range singles[max_registers];
+  uint8_t singles_count = 0;
+
+  for (uint8_t i = 0; i < registers_count; i++)
+    if (registers[i] >= merged.start && registers[i] < merged.start + merged.count)
+      singles[singles_count++] = { registers[i], 1 };
+
+  // shift the ranges behind the merged one to make space for the single reads
+  for (int i = ranges_count - 1; i > index; i--)
+    ranges[i + singles_count - 1] = ranges[i];
+
+  for (uint8_t i = 0; i < singles_count; i++)
+    ranges[index + i] = singles[i];
+
+  ranges_count += singles_count - 1;
+}
+
+uint32_t Read_planner::transaction_us(const uint8_t register_count) const
+{
+  return frame_overhead_us + 2 * register_count * char_us;
+}
+
+uint32_t Read_planner::naive_scan_us() const
+{
+  return registers_count * transaction_us(1);
+}
+
+uint32_t Read_planner::planned_scan_us() const
+{
+  uint32_t total = 0;
+
+  for (uint8_t i = 0; i < ranges_count; i++)
+    total += transaction_us(ranges[i].count);
+
+  return total;
+}
@@ -6,18 +6,16 @@
 #include <map>
 #include <FW_updater.hpp>
 #include <MQTT_client.hpp>
-#include <MD5.hpp>
+#include <Modbus_RTU.hpp>
+#include <Msgpack_writer.hpp>
+#include "Bus_config.hpp"
 #include "H300.hpp"
-
-// debug mode, set to 0 if making a release
-#define DEBUG 1
-
-// Logging macro used in debug mode
-#if DEBUG == 1
-  #define LOG(message) Serial.println(message);
-#else
-  #define LOG(message)
-#endif
+#include "Datapoint.hpp"
+#include "Device_registry.hpp"
+#include "Log.hpp"
+#include "MQTT_handlers.hpp"
+#include "Poller.hpp"
+#include "Read_planner.hpp"
 
 ////////////////////////////////////////////////////////////////////////////////
 /// CONSTANT DEFINITION
@@ -29,8 +27,19 @@
 #define MODULE_TYPE  "VFD_H300"
 
 #define LOOP_DELAY_MS   10u
+// time per loop() for publishing queued messages, the rest waits for the next loop()
+#define PUBLISH_BUDGET_US  5000u
 #define FW_UPDATE_PORT  5000u
 
+#define MQTT_PORT         1883u
+#define MQTT_BUFFER_SIZE  1024u
+// upper estimate of one device serialized in VALUE_UPDATE
+#define VALUE_UPDATE_DEVICE_SIZE  320u
+
+// loop() with MQTT runs on ARDUINO_RUNNING_CORE (1), Modbus poller on the other one.
+// WiFi driver tasks share core 0 with the poller but run at higher priority.
+#define POLLER_CORE     0
+
 ////////////////////////////////////////////////////////////////////////////////
 /// GLOBAL OBJECTS
 ////////////////////////////////////////////////////////////////////////////////
@@ -40,11 +49,53 @@ static String module_mac = WiFi.macAddress();
 static FW_updater  *fw_updater = nullptr;
 static MQTT_client *mqtt_client = nullptr;
 
-static std::vector<H300> devices;
+static Poller      *poller = nullptr;
+
+// devices of the configuration in effect, maintained by the SET_CONFIG handler
+static const Device_registry& device_registry = MQTT_handlers::device_registry();
+
+// registers of readable datapoints, each bus groups them into range reads for its baud rate
+static Read_planner read_planner(Modbus_RTU::timing(Bus_config::default_baud_rate), H300::response_delay_us);
+
+// values of the device pass being received from the poller, sized on SET_CONFIG
+static DynamicJsonDocument values_json(JSON_OBJECT_SIZE(0));
+
+// device part of STATS, sized on SET_CONFIG as well
+static DynamicJsonDocument stats_json(JSON_OBJECT_SIZE(0));
+
+// the same in MessagePack, encoded device entries and their sizes
+static std::vector<uint8_t> values_msgpack;
+static std::vector<uint16_t> values_msgpack_sizes;
+
+// a device of the pass reports a drive error or went offline, its VALUE_UPDATE is urgent
+static bool pass_alarm = false;
+
+// devices in the VALUE_UPDATE being built, by device index
+static std::vector<bool> pass_devices;
+
+// VALUE_UPDATE published early as its document was full, since the last STATS
+static uint32_t values_overflows = 0;
+
+// STATE of a device which stopped answering, published once until it answers again
+static constexpr const char* offline_state = "OFFLINE";
+static const uint8_t state_index = Datapoint::find("STATE") - Datapoints::table;
+
+// run time of loop() without its delay and bus stats, since the last STATS
+static uint32_t loop_runs = 0;
+static uint32_t loop_total_us = 0;
+static uint32_t loop_max_us = 0;
+static Bus_stats interval_bus_stats[Bus_config::max_buses];
+static uint8_t interval_bus_count = 0;
 
-static bool standby_mode = false;
+// device stats taken from the poller, kept to reuse the capacity
+static std::vector<Device_stats> device_stats;
 
-static void resolve_mqtt(String& topic, String& payload);
+static void publish_samples();
+static void publish_stats();
+static bool append_json_values(const Sample& sample);
+static void append_msgpack_values(const Sample& sample);
+static void publish_pass();
+static void reserve_publish_buffers();
 
 ////////////////////////////////////////////////////////////////////////////////
 /// SETUP
@@ -52,7 +103,7 @@ static void resolve_mqtt(String& topic, String& payload);
 
 void setup() 
 {
-  #if DEBUG == 1
+  #if DEBUG >= 1
     Serial.flush();
     Serial.end();
     delay(10);
@@ -61,6 +112,24 @@ void setup()
 
   LOG("Module MAC: " + module_mac);
 
+  if (poller == nullptr)
+  {
+    // Modbus buses are opened by the poller according to SET_CONFIG
+    for (const Datapoint& datapoint : Datapoints::table)
+      if (datapoint.readable)
+        read_planner.add_register(datapoint.register_addr);
+
+    LOG(String("Read plan: ") + read_planner.range_count() + " frames per device instead of "
+      + read_planner.register_count());
+    LOG(String("Estimated scan time per device at default baud rate: ") + read_planner.planned_scan_us() + " us instead of "
+      + read_planner.naive_scan_us() + " us, saved "
+      + (read_planner.naive_scan_us() - read_planner.planned_scan_us()) + " us");
+
+    poller = new Poller(read_planner, LOOP_DELAY_MS);
+    MQTT_handlers::setup(poller, reserve_publish_buffers);
+    poller->start(POLLER_CORE);
+  }
+
   WiFi.disconnect(true);
   while (WiFi.status() == WL_CONNECTED)
     delay(500);
@@ -87,24 +156,24 @@ void setup()
   fw_updater = new FW_updater(gateway_ip.c_str(), FW_UPDATE_PORT);
   
   if (mqtt_client)
+  {
     delete mqtt_client;
+
+    // configuration of the drives may have changed while disconnected
+    poller->revalidate_caches = true;
+    poller->wake();
+  }
   
   // MQTT broker expected to run on GW
-  mqtt_client = new MQTT_client(gateway_ip.c_str());
+  mqtt_client = new MQTT_client(gateway_ip.c_str(), MQTT_PORT, MQTT_BUFFER_SIZE);
+  mqtt_client->encoding = MQTT_handlers::value_encoding();
+  reserve_publish_buffers();
   LOG("Setting up MQTT client");
-  mqtt_client->setup_mqtt(module_mac.c_str(), MODULE_TYPE, resolve_mqtt);
+  mqtt_client->setup_mqtt(module_mac.c_str(), MODULE_TYPE);
   LOG("Connected to MQTT broker");
   mqtt_client->publish_module_id();
-  LOG("Subscribing to ALL_MODULES ...");
-  mqtt_client->subscribe("ALL_MODULES");
-  LOG("Subscribing to " + module_mac + "/SET_CONFIG ...");
-  mqtt_client->subscribe((module_mac + "/SET_CONFIG").c_str(), 2u);
-  LOG("Subscribing to " + module_mac + "/SET_VALUE ...");
-  mqtt_client->subscribe((module_mac + "/SET_VALUE").c_str(), 2u);
-  LOG("Subscribing to " + module_mac + "/UPDATE_FW ...");
-  mqtt_client->subscribe((module_mac + "/UPDATE_FW").c_str(), 2u);
-  LOG("Subscribing to " + module_mac + "/REQUEST ...");
-  mqtt_client->subscribe((module_mac + "/REQUEST").c_str(), 2u);
+  // inbound topics and their handlers
+  MQTT_handlers::connect(mqtt_client, fw_updater, module_mac);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -113,6 +182,8 @@ void setup()
 
 void loop() 
 {
+  const uint32_t loop_started_us = micros();
+
   if (!mqtt_client->loop())
   {
     LOG("Lost connection to MQTT broker, reconnecting...");
@@ -120,308 +191,319 @@ void loop()
     setup();
   }
 
-  // check if any device is present in config and standby mode is off
-  if (devices.empty() || standby_mode) 
-    return;
+  // Modbus is handled by the poller task, only its output is published here
+  publish_samples();
+  MQTT_handlers::publish_results();
 
-  // prepare json payload
-  DynamicJsonDocument json(512);
+  Poll_scheduler::Stats schedule_stats;
+  while (poller->schedule_stats.pop(schedule_stats))
+  {
+    LOGF("Scheduling: %u polls, %u skipped, lateness avg %u ms max %u ms, jitter max %u ms\n",
+      schedule_stats.polls, schedule_stats.skipped,
+      schedule_stats.polls ? schedule_stats.total_lateness_ms / schedule_stats.polls : 0,
+      schedule_stats.max_lateness_ms, schedule_stats.max_jitter_ms);
+  }
 
-  // loop through device vector
-  for (H300& device : devices) 
+  Bus_stats bus_stats;
+  while (poller->bus_stats.pop(bus_stats))
   {
-    // check if device is expected to be read (dependent on its poll rate)
-    if (!device.decrease_counter())
-      continue;
-          
-    LOG("Reading device: " + String(device.device_id.c_str()));
+    const Modbus_RTU::Latency_stats& latency = bus_stats.latency;
 
-    JsonObject device_object = json.createNestedObject(device.device_id);
+    LOGF("Bus %u: %u transactions, latency avg %u us max %u us\n",
+      bus_stats.bus_index, latency.transactions,
+      latency.transactions ? latency.total_us / latency.transactions : 0, latency.max_us);
 
-    uint16_t speed = 0;
-    if (!device.read_value(H300::speed_register, &speed))
+    if (bus_stats.bus_index < Bus_config::max_buses)
     {
-      float speed_res = float(speed) / 10;
-      
-      device_object["SPEED"] = speed_res;
-      LOG(String("\tSPEED:\t") + speed_res);
-    }
+      interval_bus_stats[bus_stats.bus_index] = bus_stats;
 
-    uint16_t state = 0;
-    if (!device.read_value(H300::state_register, &state))
-    {
-      String state_res;
-
-      if (state == 0)
-        state_res = "OK";
-      else 
-	state_res = "ERROR " + state;
-      
-      device_object["STATE"] = state_res;
-      LOG(String("\tSTATE:\t") + state_res);
-    }
-  
-    uint16_t get_freq = 0;
-    if (!device.read_value(H300::get_freq_register, &get_freq))
-    {
-      float get_freq_res = float(get_freq) / 100;
-      
-      device_object["GET_FREQ"] = get_freq_res;
-      LOG(String("\tGET_FREQ:\t") + get_freq_res);
-
-      float rpm_res = (get_freq_res * 60 * 2) / 4;
-      device_object["RPM"] = rpm_res;
-      LOG(String("\tRPM:\t") + rpm_res);
+      if (bus_stats.bus_index >= interval_bus_count)
+        interval_bus_count = bus_stats.bus_index + 1;
     }
+  }
 
-    uint16_t set_freq = 0;
-    if (!device.read_value(H300::set_freq_register, &set_freq))
-    {
-      float set_freq_res = float(set_freq) / 100;
-      
-      device_object["SET_FREQ"] = set_freq_res;
-      LOG(String("\tSET_FREQ:\t") + set_freq_res);
-    }
+  publish_stats();
+
+  // publishing waits on the network, a slow broker holds the queue back and drops telemetry
+  // instead of stalling the hand-over from the poller
+  mqtt_client->flush(PUBLISH_BUDGET_US);
+
+  // queued VALUE_UPDATE chunks dropped or lost on publish, their devices report all values again
+  if (mqtt_client->values_lost)
+  {
+    mqtt_client->values_lost = false;
+    poller->resync_values = true;
+  }
+
+  const uint32_t loop_us = micros() - loop_started_us;
+  loop_runs++;
+  loop_total_us += loop_us;
+
+  if (loop_us > loop_max_us)
+    loop_max_us = loop_us;
+
+  delay(LOOP_DELAY_MS);
+}
+
+// Publish STATS once the poller hands over the device stats of its interval
+static void publish_stats()
+{
+  uint32_t stats_generation;
+
+  if (!poller->take_device_stats(device_stats, &stats_generation))
+    return;
+
+  StaticJsonDocument<
+    JSON_OBJECT_SIZE(11) + JSON_ARRAY_SIZE(Bus_config::max_buses) + Bus_config::max_buses * JSON_OBJECT_SIZE(7)
+  > module_json;
+
+  module_json["interval_ms"] = uint32_t(Poller::stats_interval_ms);
+  module_json["loop_us_avg"] = loop_runs ? loop_total_us / loop_runs : 0;
+  module_json["loop_us_max"] = loop_max_us;
+  module_json["free_heap"] = ESP.getFreeHeap();
+  module_json["min_free_heap"] = ESP.getMinFreeHeap();
+  module_json["max_alloc_heap"] = ESP.getMaxAllocHeap();
+  module_json["publish_failures"] = mqtt_client->publish_failures;
+  module_json["queue_drops"] = mqtt_client->queue_drops;
+  module_json["oversize_count"] = mqtt_client->oversize_count;
+  module_json["values_overflows"] = values_overflows;
+
+  JsonArray buses = module_json.createNestedArray("buses");
+
+  for (uint8_t i = 0; i < interval_bus_count; i++)
+  {
+    const Bus_stats& stats = interval_bus_stats[i];
+    const Modbus_RTU::Latency_stats& latency = stats.latency;
+    JsonObject bus = buses.createNestedObject();
+
+    bus["bus"] = stats.bus_index;
+    bus["transactions"] = latency.transactions;
+    bus["latency_us_avg"] = latency.transactions ? latency.total_us / latency.transactions : 0;
+    bus["latency_us_max"] = latency.max_us;
+    bus["scans"] = stats.scans;
+    bus["scan_us_avg"] = stats.scans ? stats.scan_total_us / stats.scans : 0;
+    bus["scan_us_max"] = stats.scan_max_us;
+  }
+
+  loop_runs = 0;
+  loop_total_us = 0;
+  loop_max_us = 0;
+  interval_bus_count = 0;
+  mqtt_client->publish_failures = 0;
+  mqtt_client->queue_drops = 0;
+  mqtt_client->oversize_count = 0;
+  values_overflows = 0;
+
+  // devices changed since the poller took the stats
+  const bool devices_valid = stats_generation == MQTT_handlers::config_generation()
+    && device_stats.size() == device_registry.size();
 
-    uint16_t get_motion = 0;
-    if (!device.read_value(H300::get_motion_register, &get_motion))
+  stats_json.clear();
+
+  for (uint16_t i = 0; devices_valid && i < device_stats.size(); i++)
+  {
+    const Device_stats& stats = device_stats[i];
+
+    // device not polled in the interval, e.g. on a missing bus
+    if (stats.transactions == 0)
+      continue;
+
+    // ids outlive the document, so they are linked rather than copied
+    JsonObject device = stats_json.createNestedObject(device_registry.id(i).c_str());
+
+    device["transactions"] = stats.transactions;
+    device["timeouts"] = stats.timeouts;
+    device["crc_errors"] = stats.crc_errors;
+    device["other_errors"] = stats.other_errors;
+    device["p50_us"] = stats.percentile_us(50);
+    device["p99_us"] = stats.percentile_us(99);
+
+    // by exception code, only those which occurred
+    static constexpr const char* exception_codes[] = { "1", "2", "3", "4" };
+    JsonObject exceptions;
+
+    for (uint8_t i = 0; i < 4; i++)
     {
-      String get_motion_res;
+      if (stats.exceptions[i] == 0)
+        continue;
 
-      if (get_motion == 1)
-	get_motion_res = "FWD";
-      else if (get_motion == 2)
-	get_motion_res = "REV";
-      else if (get_motion == 3)
-	get_motion_res = "STOP";
+      if (exceptions.isNull())
+        exceptions = device.createNestedObject("exceptions");
 
-      device_object["GET_MOTION"] = get_motion_res;
-      LOG(String("\tGET_MOTION:\t") + get_motion_res);
+      exceptions[exception_codes[i]] = stats.exceptions[i];
     }
+  }
+
+  mqtt_client->publish_stats(module_json, stats_json);
+}
 
-    uint16_t accel_time = 0;
-    if (!device.read_value(H300::accel_time_register, &accel_time))
+// Build VALUE_UPDATE from samples of the poller, published at the end of each device pass
+static void publish_samples()
+{
+  Sample sample;
+
+  while (poller->samples.pop(sample))
+  {
+    // samples of the previous configuration
+    if (sample.generation != MQTT_handlers::config_generation())
+      continue;
+
+    if (sample.device_index == Poller::end_of_pass)
     {
-      device_object["ACCEL_TIME"] = accel_time;
-      LOG(String("\tACCEL_TIME:\t") + accel_time);
+      publish_pass();
+      continue;
     }
 
-    uint16_t decel_time = 0;
-    if (!device.read_value(H300::decel_time_register, &decel_time))
+    // one entry per device, a repeated device starts the next update
+    if (pass_devices[sample.device_index])
+      publish_pass();
+
+    pass_devices[sample.device_index] = true;
+
+    TRACEF(sample.offline ? "Device offline: %s\n" : "Read device: %s\n", device_registry.id(sample.device_index).c_str());
+
+    const bool alarm = sample.offline || ((sample.valid & (1u << state_index)) && sample.raw[state_index] != 0);
+    pass_alarm |= alarm;
+
+    if (MQTT_handlers::value_encoding() == MQTT_client::Encoding::MSGPACK)
     {
-      device_object["DECEL_TIME"] = decel_time;
-      LOG(String("\tDECEL_TIME:\t") + decel_time);
+      append_msgpack_values(sample);
+      continue;
     }
-    
-    uint16_t get_timer = 0;
-    if (!device.read_value(H300::get_timer_register, &get_timer))
-    {
-      float get_timer_res = float(get_timer) / 10;
 
-      device_object["GET_TIMER"] = get_timer_res;
-      LOG(String("\tGET_TIMER:\t") + get_timer_res);
-    }
+    if (append_json_values(sample))
+      continue;
+
+    // the document is full, the devices which fit go out and the device starts the next update
+    values_overflows++;
+    LOG("VALUE_UPDATE document full, published early");
+
+    values_json.remove(device_registry.id(sample.device_index).c_str());
+    publish_pass();
+    pass_devices[sample.device_index] = true;
+    pass_alarm = alarm;
+    append_json_values(sample);
+  }
+}
+
+// Add device entry to the JSON VALUE_UPDATE, false if it did not fit the document
+static bool append_json_values(const Sample& sample)
+{
+  // key points to the device id, no copy is made
+  JsonObject device_object = values_json.createNestedObject(device_registry.id(sample.device_index).c_str());
 
-    uint16_t set_timer = 0;
-    if (!device.read_value(H300::set_timer_register, &set_timer))
+  if (sample.offline)
+    device_object["STATE"] = offline_state;
+  else
+  {
+    for (uint8_t i = 0; i < Datapoints::count; i++)
     {
-      float set_timer_res = float(set_timer) / 10;
+      if (!(sample.valid & (1u << i)))
+        continue;
 
-      device_object["SET_TIMER"] = set_timer_res;
-      LOG(String("\tSET_TIMER:\t") + set_timer_res);
+      Datapoints::table[i].decode(sample.raw[i], device_object);
+      TRACEF("\t%s:\t%u\n", Datapoints::table[i].code, sample.raw[i]);
     }
   }
 
-  // publish only if at least one device was read
-  if (!json.isNull())
-    mqtt_client->publish_value_update(json); 
-
-  delay(LOOP_DELAY_MS);
+  return !values_json.overflowed();
 }
 
-////////////////////////////////////////////////////////////////////////////////
-/// MQTT RESOLVER
-////////////////////////////////////////////////////////////////////////////////
+// Publish VALUE_UPDATE of the devices collected since the last one
+static void publish_pass()
+{
+  const MQTT_client::Priority priority = pass_alarm
+    ? MQTT_client::Priority::URGENT : MQTT_client::Priority::TELEMETRY;
 
-static void resolve_mqtt(String& topic, String& payload) 
+  bool published = true;
+
+  // publish only if at least one device was read
+  if (!values_json.isNull())
+    published &= mqtt_client->publish_value_update(values_json, 0, priority);
+
+  if (!values_msgpack_sizes.empty())
+    published &= mqtt_client->publish_value_update(
+      values_msgpack.data(), values_msgpack_sizes.data(), values_msgpack_sizes.size(), 0, priority
+    );
+
+  // changes of the pass did not get out, the devices report all values with their next scan
+  if (!published)
+    poller->resync_values = true;
+
+  pass_alarm = false;
+  values_json.clear();
+  values_msgpack.clear();
+  values_msgpack_sizes.clear();
+  pass_devices.assign(pass_devices.size(), false);
+}
+
+// Append MessagePack device entry: device id and map of datapoint table index to raw
+// register value, i.e. fixed-point value scaled by the datapoint multiplier and divisor
+static void append_msgpack_values(const Sample& sample)
 {
+  const std::string& device_id = device_registry.id(sample.device_index);
+  const uint8_t value_count = __builtin_popcount(sample.valid);
 
-  LOG("Received message: " + topic + " - " + payload);
+  // str header, map header and uint16 values with fixint keys at most, or the offline state
+  const size_t offset = values_msgpack.size();
+  values_msgpack.resize(offset + 3 + device_id.size() + 3 + 4 * value_count + 1 + strlen(offline_state) + 1);
 
-  DynamicJsonDocument payload_json(256);
-  DeserializationError json_err = deserializeJson(payload_json, payload);
+  Msgpack_writer writer(&values_msgpack[offset], values_msgpack.size() - offset);
+  writer.write_str(device_id.c_str(), device_id.size());
 
-  if (json_err) 
+  if (sample.offline)
   {
-    LOG("JSON error: " + String(json_err.c_str()));
-    return;
+    writer.write_map(1);
+    writer.write_uint(state_index);
+    writer.write_str(offline_state);
   }
+  else
+    writer.write_map(value_count);
 
-  if (topic.equals("ALL_MODULES") || topic.equals(module_mac + "/REQUEST")) 
+  for (uint8_t i = 0; i < Datapoints::count; i++)
   {
-    const char* request = payload_json["request"];
+    if (!(sample.valid & (1u << i)))
+      continue;
 
-    if (request != nullptr) 
-    {
-      if (String(request) == "module_discovery")
-        mqtt_client->publish_module_id();
-      else if (String(request) == "stop") 
-      {
-        const uint16_t sequence_number = payload_json["sequence_number"];
-
-        LOG("Switching to standby mode");
-        // stop all motors using DC breaks and switch to standy mode
-        bool result = true;
-        for (H300& device : devices)
-        {
-          const uint8_t res = device.write_value(H300::set_motion_register, 6);
-
-          if (res != 0x00)
-            result = false;
-        }
-          
-        standby_mode = true;
-
-        mqtt_client->publish_request_result(sequence_number, result);        
-      } 
-      else if (String(request) == "start") 
-      {
-        const uint16_t sequence_number = payload_json["sequence_number"];
-
-        LOG("Switching to active mode");
-        // switch to active mode
-        standby_mode = false;
-
-        mqtt_client->publish_request_result(sequence_number, true);
-      }
-    }
-  } 
-  else if (topic.equals(module_mac + "/SET_CONFIG")) 
-  {    
-    JsonObject json_config = payload_json.as<JsonObject>();
-    LOG("Deleting previous configuration");
-    std::vector<H300>().swap(devices); // delete previous configuration
-
-    // create devices according to received configuration
-
-    for (const JsonPair& pair : json_config) 
-    { 
-      const char* const device_id = pair.key().c_str();
-      const JsonObject device_config = pair.value().as<JsonObject>();
-      const uint8_t unit_id = device_config["address"];
-      const uint16_t poll_rate = device_config["poll_rate"];
-
-      LOG("Creating device with parameters: ");
-      LOG(String("\t id:\t") + device_id);
-      LOG(String("\t unit_id:\t") + unit_id);
-      LOG(String("\t interval_rate:\t") + ((poll_rate * 1000) / LOOP_DELAY_MS));
-
-      devices.emplace_back(device_id, unit_id, (poll_rate * 1000) / LOOP_DELAY_MS);
-    }
+    writer.write_uint(i);
+    writer.write_uint(sample.raw[i]);
+  }
 
-    LOG("Switching to active mode");
-    // switch to active mode
-    standby_mode = false;
-    
-    LOG(String("Actual device count: ") + devices.size());
+  values_msgpack.resize(offset + writer.written());
+  values_msgpack_sizes.push_back(writer.written());
+}
+
+// Size VALUE_UPDATE and STATS buffers after the device count, only VALUE_UPDATE buffers of
+// the active encoding are kept. Publishing then runs without any allocation until the next
+// SET_CONFIG, only the pass of the largest update may grow the MessagePack buffer.
+static void reserve_publish_buffers()
+{
+  const size_t device_count = device_registry.size();
 
-    // calculate config MD5 chuecksum
-    std::string payload_cpy(payload.c_str());
-    const std::string& md5_str = MD5::make_digest(MD5::make_hash(&payload_cpy[0]), 16);
+  stats_json = DynamicJsonDocument(
+    JSON_OBJECT_SIZE(device_count) + device_count * (JSON_OBJECT_SIZE(7) + JSON_OBJECT_SIZE(4))
+  );
+  device_stats.reserve(device_count);
 
-    LOG(String("Config MD5 checksum: ") + md5_str.c_str());
+  values_msgpack.clear();
+  values_msgpack_sizes.clear();
+  pass_devices.assign(device_count, false);
 
-    mqtt_client->publish_config_update(md5_str);
-  } 
-  else if (topic.equals(module_mac + "/SET_VALUE")) 
+  if (MQTT_handlers::value_encoding() == MQTT_client::Encoding::MSGPACK)
   {
-    const char* device_id = payload_json["device_id"];
-    const char* datapoint = payload_json["datapoint"];
-    const char* value = payload_json["value"];
-    const uint16_t sequence_number = payload_json["sequence_number"];
-
-    LOG("Setting value:");
-    LOG(String("\t device_id: ") + device_id);
-    LOG(String("\t datapoint: ") + datapoint);
-    LOG(String("\t value: ") + value);
-    
-    // find the given device by its id and write the value according to datapoint
-    for (const H300& device : devices) 
-    {
-      if (device.device_id == device_id) 
-      {
-        uint8_t result = -1;
-
-        if (String(datapoint).equals("SPEED")) 
-        {
-          result = device.write_value(H300::speed_register, (uint16_t)(atof(value) * 10)); 
-        } 
-        else if (String(datapoint).equals("SET_FREQ")) 
-        {
-          result = device.write_value(H300::set_freq_register, (uint16_t)(atof(value) * 100));
-        } 
-        else if (String(datapoint).equals("SET_MOTION")) 
-        {
-	  if (strcmp(value, "FWD") == 0)
-	    result = device.write_value(H300::set_motion_register, 1);
-	  if (strcmp(value, "REV") == 0)
-	    result = device.write_value(H300::set_motion_register, 2);
-	  if (strcmp(value, "FWD_JOG") == 0)
-	    result = device.write_value(H300::set_motion_register, 3);
-	  if (strcmp(value, "REV_JOG") == 0)
-	    result = device.write_value(H300::set_motion_register, 4);
-	  if (strcmp(value, "STOP") == 0)
-	    result = device.write_value(H300::set_motion_register, 5);
-	  if (strcmp(value, "BREAK") == 0)
-	    result = device.write_value(H300::set_motion_register, 6);
-        } 
-        else if (String(datapoint).equals("ACCEL_TIME")) 
-        {
-          result = device.write_value(H300::accel_time_register, (uint16_t)atoi(value));
-        } 
-        else if (String(datapoint).equals("DECEL_TIME")) 
-        {
-          result = device.write_value(H300::decel_time_register, (uint16_t)atoi(value));
-        } 
-        else if (String(datapoint).equals("SET_TIMER")) 
-        {
-          result = device.write_value(H300::set_timer_register, (uint16_t)(atof(value) * 10));
-        } 
-        else
-        {          
-          const std::string error_msg("Error: unrecognized datapoint");
-          LOG(String("\t") + error_msg.c_str());
-          mqtt_client->publish_request_result(sequence_number, false, error_msg);
-
-          break;
-        }
-          
-        String log_msg = result == 0x00 ? "\t result: ok" : "\t result: error";
-        LOG(log_msg);
-
-        if (result == 0x00)
-          mqtt_client->publish_request_result(sequence_number, true);
-        else
-        {
-          const std::string error_msg("Error code: ");
-	  LOG(String("Error code: ") + String(result).c_str());
-          mqtt_client->publish_request_result(sequence_number, false, error_msg + String(result).c_str());
-        }
-
-        break;   
-      }   
-    }
+    values_json = DynamicJsonDocument(JSON_OBJECT_SIZE(0));
+    values_msgpack.reserve(device_count * VALUE_UPDATE_DEVICE_SIZE);
+    values_msgpack_sizes.reserve(device_count);
   }
-  else if (topic.equals(module_mac + "/UPDATE_FW")) 
+  else
   {
-    const char* version = payload_json["version"];
-    const uint16_t sequence_number = payload_json["sequence_number"];
-
-    LOG(String("Updating firmware to version: ") + version);
-    bool result = fw_updater->update(version);
-    String log_msg = result ? "\t result: ok" : "\t result: error";
-    LOG(log_msg);
-    
-    mqtt_client->publish_request_result(sequence_number, result);
+    // STATE error text is the only copied string
+    values_json = DynamicJsonDocument(
+      JSON_OBJECT_SIZE(device_count) + device_count * (JSON_OBJECT_SIZE(Datapoints::count) + 12)
+    );
+    std::vector<uint8_t>().swap(values_msgpack);
+    std::vector<uint16_t>().swap(values_msgpack_sizes);
   }
+
+  mqtt_client->reserve_value_update(device_count * VALUE_UPDATE_DEVICE_SIZE);
 }
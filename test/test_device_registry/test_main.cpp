@@ -0,0 +1,133 @@
+#include <unity.h>
+#include <stdio.h>
+#include <Device_registry.hpp>
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+static void test_add_and_find()
+{
+  Device_registry registry;
+
+  TEST_ASSERT_TRUE(registry.add("vfd1", 0, 1) == Device_registry::Result::ADDED);
+  TEST_ASSERT_TRUE(registry.add("vfd2", 1, 1) == Device_registry::Result::ADDED);
+
+  TEST_ASSERT_EQUAL(2, registry.size());
+  TEST_ASSERT_EQUAL(0, registry.find("vfd1"));
+  TEST_ASSERT_EQUAL(1, registry.find("vfd2"));
+  TEST_ASSERT_EQUAL_STRING("vfd2", registry.id(1).c_str());
+  TEST_ASSERT_EQUAL(0, registry.find_unit(0, 1));
+  TEST_ASSERT_EQUAL(1, registry.find_unit(1, 1));
+}
+
+static void test_not_found()
+{
+  Device_registry registry;
+  registry.add("vfd1", 0, 1);
+
+  TEST_ASSERT_EQUAL(Device_registry::not_found, registry.find("vfd"));
+  TEST_ASSERT_EQUAL(Device_registry::not_found, registry.find("vfd10"));
+  TEST_ASSERT_EQUAL(Device_registry::not_found, registry.find(nullptr));
+  TEST_ASSERT_EQUAL(Device_registry::not_found, registry.find_unit(0, 2));
+  TEST_ASSERT_EQUAL(Device_registry::not_found, registry.find_unit(Bus_config::max_buses, 1));
+}
+
+static void test_duplicates_refused()
+{
+  Device_registry registry;
+  registry.add("vfd1", 0, 1);
+
+  TEST_ASSERT_TRUE(registry.add("vfd1", 0, 2) == Device_registry::Result::DUPLICATE_ID);
+  TEST_ASSERT_TRUE(registry.add("vfd2", 0, 1) == Device_registry::Result::DUPLICATE_UNIT);
+  TEST_ASSERT_TRUE(registry.add("vfd2", Bus_config::max_buses, 2) == Device_registry::Result::INVALID);
+  TEST_ASSERT_TRUE(registry.add(nullptr, 0, 2) == Device_registry::Result::INVALID);
+  TEST_ASSERT_EQUAL(1, registry.size());
+
+  // the same unit on the other bus is another drive
+  TEST_ASSERT_TRUE(registry.add("vfd2", 1, 1) == Device_registry::Result::ADDED);
+}
+
+// 0 is the broadcast address, the ones above 247 are reserved
+static void test_unit_out_of_range_refused()
+{
+  Device_registry registry;
+
+  TEST_ASSERT_TRUE(registry.add("vfd0", 0, 0) == Device_registry::Result::INVALID);
+  TEST_ASSERT_TRUE(registry.add("vfd248", 0, 248) == Device_registry::Result::INVALID);
+  TEST_ASSERT_TRUE(registry.add("vfd255", 1, 255) == Device_registry::Result::INVALID);
+  TEST_ASSERT_EQUAL(0, registry.size());
+
+  TEST_ASSERT_TRUE(registry.add("vfd1", 0, 1) == Device_registry::Result::ADDED);
+  TEST_ASSERT_TRUE(registry.add("vfd247", 0, 247) == Device_registry::Result::ADDED);
+}
+
+// The table grows while devices are added, all of them are still found afterwards
+static void test_grows_past_initial_table()
+{
+  Device_registry registry;
+  char device_id[16];
+
+  for (uint16_t i = 0; i < 247; i++)
+  {
+    snprintf(device_id, sizeof(device_id), "vfd%u", i);
+    TEST_ASSERT_TRUE(registry.add(device_id, i % Bus_config::max_buses, i / Bus_config::max_buses + 1)
+      == Device_registry::Result::ADDED);
+  }
+
+  for (uint16_t i = 0; i < 247; i++)
+  {
+    snprintf(device_id, sizeof(device_id), "vfd%u", i);
+    TEST_ASSERT_EQUAL(i, registry.find(device_id));
+    TEST_ASSERT_EQUAL(i, registry.find_unit(i % Bus_config::max_buses, i / Bus_config::max_buses + 1));
+  }
+}
+
+static void test_reserve_keeps_devices()
+{
+  Device_registry registry;
+  registry.add("vfd1", 0, 1);
+  registry.reserve(100);
+  registry.add("vfd2", 0, 2);
+
+  TEST_ASSERT_EQUAL(0, registry.find("vfd1"));
+  TEST_ASSERT_EQUAL(1, registry.find("vfd2"));
+}
+
+static void test_swap_and_clear()
+{
+  Device_registry registry;
+  Device_registry next;
+  registry.add("old", 0, 1);
+  next.add("new", 0, 1);
+
+  registry.swap(next);
+
+  TEST_ASSERT_EQUAL(0, registry.find("new"));
+  TEST_ASSERT_EQUAL(Device_registry::not_found, registry.find("old"));
+  TEST_ASSERT_EQUAL(0, next.find("old"));
+
+  registry.clear();
+
+  TEST_ASSERT_EQUAL(0, registry.size());
+  TEST_ASSERT_EQUAL(Device_registry::not_found, registry.find("new"));
+  TEST_ASSERT_EQUAL(Device_registry::not_found, registry.find_unit(0, 1));
+  TEST_ASSERT_TRUE(registry.add("new", 0, 1) == Device_registry::Result::ADDED);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_add_and_find);
+  RUN_TEST(test_not_found);
+  RUN_TEST(test_duplicates_refused);
+  RUN_TEST(test_unit_out_of_range_refused);
+  RUN_TEST(test_grows_past_initial_table);
+  RUN_TEST(test_reserve_keeps_devices);
+  RUN_TEST(test_swap_and_clear);
+  return UNITY_END();
+}
@@ -0,0 +1,161 @@
+#include <unity.h>
+#include <stdint.h>
+#include <H300.hpp>
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+static const uint16_t all_valid = 0x000F;
+
+// Device with its first full report of raw already published at time 0
+static void publish_first(H300& device, const uint16_t* const raw)
+{
+  device.mark_reported(raw, device.report_changes(raw, all_valid, 0), 0);
+}
+
+static void test_first_report_is_full()
+{
+  H300 device(0, "vfd1", 1, 1000);
+  const uint16_t raw[H300::max_datapoints] = { 100, 200, 300, 400 };
+
+  device.deadbands[0] = 50;
+
+  TEST_ASSERT_EQUAL_HEX16(all_valid, device.report_changes(raw, all_valid, 0));
+  TEST_ASSERT_EQUAL_HEX16(0x0005, device.report_changes(raw, 0x0005, 0));
+
+  // nothing counts as published before mark_reported()
+  TEST_ASSERT_EQUAL_HEX16(all_valid, device.report_changes(raw, all_valid, 10));
+}
+
+static void test_deadband_threshold()
+{
+  H300 device(0, "vfd1", 1, 1000);
+  uint16_t raw[H300::max_datapoints] = { 100, 200, 300, 400 };
+
+  device.deadbands[0] = 10;
+  device.deadbands[1] = 10;
+  publish_first(device, raw);
+
+  TEST_ASSERT_EQUAL_HEX16(0, device.report_changes(raw, all_valid, 1000));
+
+  // a change must exceed the deadband, in either direction
+  raw[0] = 110;
+  raw[1] = 190;
+  TEST_ASSERT_EQUAL_HEX16(0, device.report_changes(raw, all_valid, 1000));
+
+  raw[0] = 111;
+  raw[1] = 189;
+  TEST_ASSERT_EQUAL_HEX16(0x0003, device.report_changes(raw, all_valid, 1000));
+
+  // without a deadband every change is published
+  raw[0] = 100;
+  raw[1] = 200;
+  raw[2] = 301;
+  TEST_ASSERT_EQUAL_HEX16(0x0004, device.report_changes(raw, all_valid, 1000));
+
+  // datapoints which were not read are never published
+  TEST_ASSERT_EQUAL_HEX16(0, device.report_changes(raw, 0x000B, 1000));
+}
+
+static void test_deadband_from_published_value()
+{
+  H300 device(0, "vfd1", 1, 1000);
+  uint16_t raw[H300::max_datapoints] = { 100 };
+
+  device.deadbands[0] = 8;
+  publish_first(device, raw);
+
+  // slow drift is compared to the last published value, not the last scan
+  raw[0] = 105;
+  TEST_ASSERT_EQUAL_HEX16(0, device.report_changes(raw, 0x0001, 1000));
+
+  raw[0] = 110;
+  const uint16_t report = device.report_changes(raw, 0x0001, 2000);
+  TEST_ASSERT_EQUAL_HEX16(0x0001, report);
+  device.mark_reported(raw, report, 2000);
+
+  raw[0] = 115;
+  TEST_ASSERT_EQUAL_HEX16(0, device.report_changes(raw, 0x0001, 3000));
+}
+
+static void test_snapshot_interval_full_report()
+{
+  H300 device(0, "vfd1", 1, 1000);
+  const uint16_t raw[H300::max_datapoints] = { 100, 200, 300, 400 };
+
+  device.snapshot_interval = 5000;
+  publish_first(device, raw);
+
+  TEST_ASSERT_EQUAL_HEX16(0, device.report_changes(raw, all_valid, 4999));
+  TEST_ASSERT_EQUAL_HEX16(all_valid, device.report_changes(raw, all_valid, 5000));
+
+  // the interval restarts with the full report which was published
+  device.mark_reported(raw, all_valid, 5500);
+  TEST_ASSERT_EQUAL_HEX16(0, device.report_changes(raw, all_valid, 10000));
+  TEST_ASSERT_EQUAL_HEX16(all_valid, device.report_changes(raw, all_valid, 10500));
+
+  // a partial report within the interval does not restart it
+  uint16_t changed[H300::max_datapoints] = { 101, 200, 300, 400 };
+  device.mark_reported(raw, all_valid, 10500);
+  device.mark_reported(changed, 0x0001, 12000);
+  TEST_ASSERT_EQUAL_HEX16(all_valid, device.report_changes(changed, all_valid, 15500));
+}
+
+static void test_snapshot_interval_wraps()
+{
+  H300 device(0, "vfd1", 1, 1000);
+  const uint16_t raw[H300::max_datapoints] = { 100, 200, 300, 400 };
+  const uint32_t start = UINT32_MAX - 1000;
+
+  device.snapshot_interval = 5000;
+  device.mark_reported(raw, device.report_changes(raw, all_valid, start), start);
+
+  TEST_ASSERT_EQUAL_HEX16(0, device.report_changes(raw, all_valid, start + 4999));
+  TEST_ASSERT_EQUAL_HEX16(all_valid, device.report_changes(raw, all_valid, start + 5000));
+}
+
+static void test_snapshot_every_poll()
+{
+  H300 device(0, "vfd1", 1, 1000);
+  const uint16_t raw[H300::max_datapoints] = { 100, 200, 300, 400 };
+
+  device.snapshot_interval = 0;
+  device.deadbands[0] = 1000;
+  publish_first(device, raw);
+
+  TEST_ASSERT_EQUAL_HEX16(all_valid, device.report_changes(raw, all_valid, 1));
+  TEST_ASSERT_EQUAL_HEX16(0x0006, device.report_changes(raw, 0x0006, 2));
+}
+
+static void test_force_snapshot()
+{
+  H300 device(0, "vfd1", 1, 1000);
+  const uint16_t raw[H300::max_datapoints] = { 100, 200, 300, 400 };
+
+  publish_first(device, raw);
+  TEST_ASSERT_EQUAL_HEX16(0, device.report_changes(raw, all_valid, 1000));
+
+  device.force_snapshot();
+  TEST_ASSERT_EQUAL_HEX16(all_valid, device.report_changes(raw, all_valid, 1000));
+
+  device.mark_reported(raw, all_valid, 1000);
+  TEST_ASSERT_EQUAL_HEX16(0, device.report_changes(raw, all_valid, 2000));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_first_report_is_full);
+  RUN_TEST(test_deadband_threshold);
+  RUN_TEST(test_deadband_from_published_value);
+  RUN_TEST(test_snapshot_interval_full_report);
+  RUN_TEST(test_snapshot_interval_wraps);
+  RUN_TEST(test_snapshot_every_poll);
+  RUN_TEST(test_force_snapshot);
+  return UNITY_END();
+}
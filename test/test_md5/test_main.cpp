@@ -0,0 +1,108 @@
+#include <unity.h>
+#include <stdlib.h>
+#include <string.h>
+#include <MD5.hpp>
+
+// test suite of RFC 1321
+static const char* const messages[] = {
+  "",
+  "a",
+  "abc",
+  "message digest",
+  "abcdefghijklmnopqrstuvwxyz",
+  "12345678901234567890123456789012345678901234567890123456789012345678901234567890"
+};
+
+static const char* const digests[] = {
+  "d41d8cd98f00b204e9800998ecf8427e",
+  "0cc175b9c0f1b6a831c399e269772661",
+  "900150983cd24fb0d6963f7d28e17f72",
+  "f96b697d7cb7938d525a2f31aaf161d0",
+  "c3fcd3d76192e4007dfb496cca67e13b",
+  "57edf4a22be3c955ac49da2e2107b67a"
+};
+
+static constexpr size_t message_count = sizeof(messages) / sizeof(messages[0]);
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+static void test_rfc_digests()
+{
+  for (size_t i = 0; i < message_count; i++)
+  {
+    char digest[MD5::digest_length + 1];
+    MD5::Hasher hasher;
+    hasher.update(messages[i], strlen(messages[i]));
+    hasher.finish_digest(digest);
+
+    TEST_ASSERT_EQUAL_STRING(digests[i], digest);
+  }
+}
+
+// Pieces of any size, crossing the 64 byte blocks, hash as the whole message
+static void test_pieces()
+{
+  const char* const message = messages[message_count - 1];
+  const size_t length = strlen(message);
+
+  for (size_t piece = 1; piece <= length; piece++)
+  {
+    char digest[MD5::digest_length + 1];
+    MD5::Hasher hasher;
+
+    for (size_t offset = 0; offset < length; offset += piece)
+      hasher.update(message + offset, length - offset < piece ? length - offset : piece);
+
+    hasher.finish_digest(digest);
+
+    TEST_ASSERT_EQUAL_STRING(digests[message_count - 1], digest);
+  }
+}
+
+// Input at every alignment, the fast path reads whole words only when aligned
+static void test_unaligned()
+{
+  const char* const message = messages[message_count - 1];
+  const size_t length = strlen(message);
+  char buffer[128];
+
+  for (size_t offset = 0; offset < 4; offset++)
+  {
+    memcpy(buffer + offset, message, length);
+
+    char digest[MD5::digest_length + 1];
+    MD5::Hasher hasher;
+    hasher.update(buffer + offset, length);
+    hasher.finish_digest(digest);
+
+    TEST_ASSERT_EQUAL_STRING(digests[message_count - 1], digest);
+  }
+}
+
+static void test_allocating_helpers()
+{
+  char message[] = "abc";
+  unsigned char* const hash = MD5::make_hash(message);
+  char* const digest = MD5::make_digest(hash, MD5::hash_length);
+
+  TEST_ASSERT_EQUAL_STRING(digests[2], digest);
+
+  free(digest);
+  free(hash);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_rfc_digests);
+  RUN_TEST(test_pieces);
+  RUN_TEST(test_unaligned);
+  RUN_TEST(test_allocating_helpers);
+  return UNITY_END();
+}
@@ -0,0 +1,376 @@
+#include <unity.h>
+#include <deque>
+#include <vector>
+#include <Modbus_RTU.hpp>
+
+// 115200 baud keeps every transaction within a few milliseconds
+static constexpr unsigned long baud_rate = 115200;
+static constexpr uint32_t response_timeout_ms = 50;
+
+typedef std::vector<uint8_t> Frame;
+
+// Unit on the other end of the line, answers every request with the next scripted
+// response. An empty response leaves the request unanswered.
+class Scripted_unit : public Stream
+{
+  public:
+    std::vector<Frame> requests;
+    std::deque<Frame> responses;
+
+    int available() override { return pending.size(); }
+
+    int read() override
+    {
+      if (pending.empty())
+        return -1;
+
+      const uint8_t byte = pending.front();
+      pending.pop_front();
+      return byte;
+    }
+
+    size_t write(const uint8_t* const buffer, const size_t size) override
+    {
+      requests.push_back(Frame(buffer, buffer + size));
+
+      if (!responses.empty())
+      {
+        pending.insert(pending.end(), responses.front().begin(), responses.front().end());
+        responses.pop_front();
+      }
+
+      return size;
+    }
+
+  private:
+    std::deque<uint8_t> pending;
+};
+
+// Transactions as reported to the callback, in order of completion
+static std::vector<Modbus_RTU::Transaction> completed;
+
+static void record(void*, const Modbus_RTU::Transaction& transaction)
+{
+  completed.push_back(transaction);
+}
+
+static uint16_t crc16(const Frame& frame)
+{
+  uint16_t crc = 0xFFFF;
+
+  for (const uint8_t byte : frame)
+  {
+    crc ^= byte;
+
+    for (uint8_t bit = 0; bit < 8; bit++)
+      crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+  }
+
+  return crc;
+}
+
+static Frame with_crc(Frame frame)
+{
+  const uint16_t crc = crc16(frame);
+  frame.push_back(crc & 0xFF);
+  frame.push_back(crc >> 8);
+  return frame;
+}
+
+// Poll until the bus has nothing left to do, false if it takes longer than a second
+static bool run(Modbus_RTU& bus)
+{
+  const uint32_t started = millis();
+
+  while (!bus.idle())
+  {
+    if (millis() - started > 1000)
+      return false;
+
+    bus.poll();
+  }
+
+  return true;
+}
+
+void setUp()
+{
+  completed.clear();
+}
+
+void tearDown()
+{
+}
+
+// Request frame of the spec example and its response, CRC low byte first
+static void test_read()
+{
+  Scripted_unit unit;
+  Modbus_RTU bus(unit, baud_rate, 0, 0, response_timeout_ms);
+  unit.responses.push_back(with_crc({ 0x01, 0x03, 0x02, 0x12, 0x34 }));
+
+  TEST_ASSERT_TRUE(bus.read_holding_registers(1, 0, 1, record, nullptr, 7));
+  TEST_ASSERT_TRUE(run(bus));
+
+  const uint8_t request[] = { 0x01, 0x03, 0x00, 0x00, 0x00, 0x01, 0x84, 0x0A };
+  TEST_ASSERT_EQUAL(1, unit.requests.size());
+  TEST_ASSERT_EQUAL(sizeof(request), unit.requests[0].size());
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(request, unit.requests[0].data(), sizeof(request));
+
+  TEST_ASSERT_EQUAL(1, completed.size());
+  TEST_ASSERT_EQUAL(Modbus_RTU::success, completed[0].result);
+  TEST_ASSERT_EQUAL(7, completed[0].tag);
+  TEST_ASSERT_EQUAL(0x1234, completed[0].values[0]);
+}
+
+static void test_read_byte_count_mismatch()
+{
+  Scripted_unit unit;
+  Modbus_RTU bus(unit, baud_rate, 0, 0, response_timeout_ms);
+  unit.responses.push_back(with_crc({ 0x01, 0x03, 0x04, 0x12, 0x34 }));
+
+  bus.read_holding_registers(1, 0, 1, record);
+  TEST_ASSERT_TRUE(run(bus));
+
+  TEST_ASSERT_EQUAL(Modbus_RTU::invalid_function, completed[0].result);
+}
+
+static void test_write_single_echo()
+{
+  Scripted_unit unit;
+  Modbus_RTU bus(unit, baud_rate, 0, 0, response_timeout_ms);
+  unit.responses.push_back(with_crc({ 0x01, 0x06, 0x00, 0x01, 0x00, 0x03 }));
+  // echo of another value
+  unit.responses.push_back(with_crc({ 0x01, 0x06, 0x00, 0x01, 0x00, 0x04 }));
+
+  bus.write_single_register(1, 1, 3, record);
+  bus.write_single_register(1, 1, 3, record);
+  TEST_ASSERT_TRUE(run(bus));
+
+  const uint8_t request[] = { 0x01, 0x06, 0x00, 0x01, 0x00, 0x03, 0x98, 0x0B };
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(request, unit.requests[0].data(), sizeof(request));
+
+  TEST_ASSERT_EQUAL(2, completed.size());
+  TEST_ASSERT_EQUAL(Modbus_RTU::success, completed[0].result);
+  TEST_ASSERT_EQUAL(Modbus_RTU::invalid_function, completed[1].result);
+}
+
+static void test_write_multiple_echo()
+{
+  Scripted_unit unit;
+  Modbus_RTU bus(unit, baud_rate, 0, 0, response_timeout_ms);
+  const uint16_t values[] = { 0x0102, 0x0304 };
+  unit.responses.push_back(with_crc({ 0x01, 0x10, 0x00, 0x10, 0x00, 0x02 }));
+  // echo of another quantity
+  unit.responses.push_back(with_crc({ 0x01, 0x10, 0x00, 0x10, 0x00, 0x01 }));
+
+  bus.write_multiple_registers(1, 0x10, 2, values, record);
+  bus.write_multiple_registers(1, 0x10, 2, values, record);
+  TEST_ASSERT_TRUE(run(bus));
+
+  const Frame request = with_crc({ 0x01, 0x10, 0x00, 0x10, 0x00, 0x02, 0x04, 0x01, 0x02, 0x03, 0x04 });
+  TEST_ASSERT_EQUAL(request.size(), unit.requests[0].size());
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(request.data(), unit.requests[0].data(), request.size());
+
+  TEST_ASSERT_EQUAL(Modbus_RTU::success, completed[0].result);
+  TEST_ASSERT_EQUAL(Modbus_RTU::invalid_function, completed[1].result);
+}
+
+// Exception responses are shorter than the expected response and carry the code
+static void test_exception()
+{
+  Scripted_unit unit;
+  Modbus_RTU bus(unit, baud_rate, 0, 0, response_timeout_ms);
+  unit.responses.push_back(with_crc({ 0x01, 0x83, 0x04 }));
+  unit.responses.push_back(with_crc({ 0x01, 0x86, 0x02 }));
+
+  bus.read_holding_registers(1, 0, 4, record);
+  TEST_ASSERT_TRUE(run(bus));
+  bus.write_single_register(1, 1, 3, record);
+  TEST_ASSERT_TRUE(run(bus));
+
+  TEST_ASSERT_EQUAL(2, completed.size());
+  TEST_ASSERT_EQUAL(Modbus_RTU::slave_device_failure, completed[0].result);
+  TEST_ASSERT_EQUAL(Modbus_RTU::illegal_data_address, completed[1].result);
+}
+
+static void test_invalid_crc_and_unit()
+{
+  Scripted_unit unit;
+  Modbus_RTU bus(unit, baud_rate, 0, 0, response_timeout_ms);
+  Frame broken = with_crc({ 0x01, 0x03, 0x02, 0x12, 0x34 });
+  broken[3] ^= 0x01;
+  unit.responses.push_back(broken);
+  unit.responses.push_back(with_crc({ 0x02, 0x03, 0x02, 0x12, 0x34 }));
+
+  bus.read_holding_registers(1, 0, 1, record);
+  bus.read_holding_registers(1, 0, 1, record);
+  TEST_ASSERT_TRUE(run(bus));
+
+  TEST_ASSERT_EQUAL(Modbus_RTU::invalid_crc, completed[0].result);
+  TEST_ASSERT_EQUAL(Modbus_RTU::invalid_slave_id, completed[1].result);
+}
+
+// A response cut short waits for the rest up to the response timeout
+static void test_short_frame()
+{
+  Scripted_unit unit;
+  Modbus_RTU bus(unit, baud_rate, 0, 0, response_timeout_ms);
+  unit.responses.push_back({ 0x01, 0x03, 0x02 });
+
+  const uint32_t started = millis();
+  bus.read_holding_registers(1, 0, 1, record);
+  TEST_ASSERT_TRUE(run(bus));
+
+  TEST_ASSERT_EQUAL(Modbus_RTU::response_timed_out, completed[0].result);
+  TEST_ASSERT_TRUE(millis() - started >= response_timeout_ms);
+}
+
+// A silent unit is given up after the first byte timeout rather than the response timeout
+static void test_first_byte_timeout()
+{
+  Scripted_unit unit;
+  Modbus_RTU bus(unit, baud_rate, 0, 0, 1000);
+  unit.responses.push_back({});
+
+  const uint32_t started = millis();
+  bus.read_holding_registers(1, 0, 1, record, nullptr, 0, 5000);
+  TEST_ASSERT_TRUE(run(bus));
+
+  TEST_ASSERT_EQUAL(Modbus_RTU::response_timed_out, completed[0].result);
+  TEST_ASSERT_TRUE(millis() - started < 500);
+}
+
+static void test_broadcast_unanswered()
+{
+  Scripted_unit unit;
+  Modbus_RTU bus(unit, baud_rate, 0, 0, response_timeout_ms);
+
+  bus.write_single_register(Modbus_RTU::broadcast_address, 1, 3, record);
+  TEST_ASSERT_TRUE(run(bus));
+
+  TEST_ASSERT_EQUAL(1, unit.requests.size());
+  TEST_ASSERT_EQUAL(Modbus_RTU::success, completed[0].result);
+}
+
+// Writes go ahead of reads waiting in the queue, but not of the read on the bus
+static void test_writes_overtake_reads()
+{
+  Scripted_unit unit;
+  Modbus_RTU bus(unit, baud_rate, 0, 0, response_timeout_ms);
+
+  for (uint8_t i = 0; i < 4; i++)
+    unit.responses.push_back({});
+
+  bus.read_holding_registers(1, 0, 1, record, nullptr, 1);
+  bus.read_holding_registers(1, 0, 1, record, nullptr, 2);
+
+  // first read on the bus
+  while (unit.requests.empty())
+    bus.poll();
+
+  bus.write_single_register(1, 1, 3, record, nullptr, 3);
+  bus.write_single_register(1, 2, 3, record, nullptr, 4);
+  TEST_ASSERT_TRUE(bus.writes_pending());
+  TEST_ASSERT_TRUE(run(bus));
+
+  TEST_ASSERT_EQUAL(4, completed.size());
+  TEST_ASSERT_EQUAL(1, completed[0].tag);
+  TEST_ASSERT_EQUAL(3, completed[1].tag);
+  TEST_ASSERT_EQUAL(4, completed[2].tag);
+  TEST_ASSERT_EQUAL(2, completed[3].tag);
+  TEST_ASSERT_FALSE(bus.writes_pending());
+}
+
+static void test_queue_full()
+{
+  Scripted_unit unit;
+  Modbus_RTU bus(unit, baud_rate, 0, 0, response_timeout_ms);
+
+  for (uint8_t i = 0; i < Modbus_RTU::queue_size; i++)
+    TEST_ASSERT_TRUE(bus.read_holding_registers(1, 0, 1, record));
+
+  TEST_ASSERT_FALSE(bus.read_holding_registers(1, 0, 1, record));
+  TEST_ASSERT_FALSE(bus.write_single_register(1, 1, 3, record));
+  TEST_ASSERT_FALSE(bus.read_holding_registers(1, 0, 0, record));
+  TEST_ASSERT_FALSE(bus.read_holding_registers(1, 0, Modbus_RTU::max_registers + 1, record));
+}
+
+// Cancelled requests never call back, the one on the bus is finished silently and the
+// requests of others complete as usual
+static void test_cancel()
+{
+  Scripted_unit unit;
+  Modbus_RTU bus(unit, baud_rate, 0, 0, response_timeout_ms);
+  int cancelled_context;
+  int kept_context;
+
+  for (uint8_t i = 0; i < 3; i++)
+    unit.responses.push_back(with_crc({ 0x01, 0x03, 0x02, 0x00, i }));
+
+  bus.read_holding_registers(1, 0, 1, record, &cancelled_context, 1);
+  bus.read_holding_registers(1, 0, 1, record, &kept_context, 2);
+  bus.read_holding_registers(1, 0, 1, record, &cancelled_context, 3);
+  bus.read_holding_registers(1, 0, 1, record, &kept_context, 4);
+
+  while (unit.requests.empty())
+    bus.poll();
+
+  bus.cancel(&cancelled_context);
+  TEST_ASSERT_TRUE(run(bus));
+
+  TEST_ASSERT_EQUAL(3, unit.requests.size());
+  TEST_ASSERT_EQUAL(2, completed.size());
+  TEST_ASSERT_EQUAL(2, completed[0].tag);
+  TEST_ASSERT_EQUAL(4, completed[1].tag);
+  TEST_ASSERT_EQUAL(Modbus_RTU::success, completed[0].result);
+  TEST_ASSERT_EQUAL(Modbus_RTU::success, completed[1].result);
+}
+
+// Every queued request is called back with the result, the one on the bus included
+static void test_abort()
+{
+  Scripted_unit unit;
+  Modbus_RTU bus(unit, baud_rate, 0, 0, response_timeout_ms);
+  unit.responses.push_back({});
+
+  bus.read_holding_registers(1, 0, 1, record, nullptr, 1);
+  bus.write_single_register(1, 1, 3, record, nullptr, 2);
+  bus.read_holding_registers(1, 0, 1, record, nullptr, 3);
+
+  while (unit.requests.empty())
+    bus.poll();
+
+  bus.abort(0xF3);
+
+  TEST_ASSERT_TRUE(bus.idle());
+  TEST_ASSERT_EQUAL(3, completed.size());
+
+  for (const Modbus_RTU::Transaction& transaction : completed)
+    TEST_ASSERT_EQUAL(0xF3, transaction.result);
+
+  // the bus is usable afterwards
+  unit.responses.push_back(with_crc({ 0x01, 0x03, 0x02, 0x00, 0x01 }));
+  bus.read_holding_registers(1, 0, 1, record, nullptr, 4);
+  TEST_ASSERT_TRUE(run(bus));
+  TEST_ASSERT_EQUAL(Modbus_RTU::success, completed[3].result);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_read);
+  RUN_TEST(test_read_byte_count_mismatch);
+  RUN_TEST(test_write_single_echo);
+  RUN_TEST(test_write_multiple_echo);
+  RUN_TEST(test_exception);
+  RUN_TEST(test_invalid_crc_and_unit);
+  RUN_TEST(test_short_frame);
+  RUN_TEST(test_first_byte_timeout);
+  RUN_TEST(test_broadcast_unanswered);
+  RUN_TEST(test_writes_overtake_reads);
+  RUN_TEST(test_queue_full);
+  RUN_TEST(test_cancel);
+  RUN_TEST(test_abort);
+  return UNITY_END();
+}
@@ -0,0 +1,282 @@
+#include <unity.h>
+#include <stdio.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include <MQTT.h>
+#include <MQTT_client.hpp>
+#include <Msgpack_writer.hpp>
+
+static const char* const module_mac = "AA:BB:CC:DD:EE:FF";
+
+// messages the client got out to the broker, in order
+static std::vector<std::pair<std::string, std::string>> published;
+
+static std::string received_payload;
+static uint32_t request_count;
+static uint32_t set_value_count;
+
+static void handle_request(const char* const payload, const size_t length)
+{
+  received_payload.assign(payload, length);
+  request_count++;
+}
+
+static void handle_set_value(const char* const, const size_t)
+{
+  set_value_count++;
+}
+
+// VALUE_UPDATE of a single device without values, as encoded by main.cpp
+static bool publish_device(MQTT_client& client, const char* const device_id)
+{
+  uint8_t entry[32];
+  Msgpack_writer writer(entry, sizeof(entry));
+  writer.write_str(device_id);
+  writer.write_map(0);
+  const uint16_t entry_size = writer.written();
+
+  return client.publish_value_update(entry, &entry_size, 1);
+}
+
+static bool published_device(const size_t index, const char* const device_id)
+{
+  return index < published.size() && published[index].first == "VALUE_UPDATE"
+    && published[index].second.find(device_id) != std::string::npos;
+}
+
+void setUp()
+{
+  published.clear();
+  received_payload.clear();
+  request_count = 0;
+  set_value_count = 0;
+
+  Local_broker::instance().listen([](const std::string& topic, const std::string& payload) {
+    published.emplace_back(topic, payload);
+  });
+}
+
+void tearDown()
+{
+  Local_broker::instance().listen(nullptr);
+}
+
+// Topics sharing a prefix are told apart, the payload is handed over with its length
+static void test_dispatch_by_topic()
+{
+  MQTT_client client("127.0.0.1");
+  client.setup_mqtt(module_mac, "H300");
+  TEST_ASSERT_TRUE(client.route("AA:BB:CC:DD:EE:FF/REQUEST", handle_request));
+  TEST_ASSERT_TRUE(client.route("AA:BB:CC:DD:EE:FF/REQUEST_X", handle_set_value));
+
+  TEST_ASSERT_TRUE(client.dispatch("AA:BB:CC:DD:EE:FF/REQUEST", "{\"a\":1}", 7));
+  TEST_ASSERT_EQUAL(1, request_count);
+  TEST_ASSERT_EQUAL(0, set_value_count);
+  TEST_ASSERT_EQUAL_STRING("{\"a\":1}", received_payload.c_str());
+
+  TEST_ASSERT_TRUE(client.dispatch("AA:BB:CC:DD:EE:FF/REQUEST_X", "", 0));
+  TEST_ASSERT_EQUAL(1, set_value_count);
+
+  TEST_ASSERT_FALSE(client.dispatch("AA:BB:CC:DD:EE:FF/REQ", "", 0));
+  TEST_ASSERT_FALSE(client.dispatch("11:22:33:44:55:66/REQUEST", "", 0));
+  TEST_ASSERT_EQUAL(1, request_count);
+}
+
+static void test_dispatch_from_broker()
+{
+  MQTT_client client("127.0.0.1");
+  client.setup_mqtt(module_mac, "H300");
+  client.route("AA:BB:CC:DD:EE:FF/REQUEST", handle_request);
+
+  Local_broker::instance().inject("AA:BB:CC:DD:EE:FF/REQUEST", "{}");
+  Local_broker::instance().inject("AA:BB:CC:DD:EE:FF/UNKNOWN", "{}");
+  client.loop();
+
+  TEST_ASSERT_EQUAL(1, request_count);
+  TEST_ASSERT_EQUAL_STRING("{}", received_payload.c_str());
+}
+
+static void test_route_limit()
+{
+  MQTT_client client("127.0.0.1");
+  client.setup_mqtt(module_mac, "H300");
+  char topic[32];
+
+  for (uint8_t i = 0; i < MQTT_client::max_routes; i++)
+  {
+    snprintf(topic, sizeof(topic), "TOPIC_%u", i);
+    TEST_ASSERT_TRUE(client.route(topic, handle_request));
+  }
+
+  TEST_ASSERT_FALSE(client.route("TOPIC_X", handle_request));
+  TEST_ASSERT_TRUE(client.dispatch("TOPIC_7", "", 0));
+}
+
+// Nothing waits in the queue, the message goes out without waiting for flush()
+static void test_published_directly()
+{
+  MQTT_client client("127.0.0.1");
+  client.setup_mqtt(module_mac, "H300");
+
+  TEST_ASSERT_TRUE(client.publish_request_result(1, true));
+  TEST_ASSERT_TRUE(publish_device(client, "vfd1"));
+
+  TEST_ASSERT_EQUAL(2, published.size());
+  TEST_ASSERT_EQUAL_STRING("REQUEST_RESULT", published[0].first.c_str());
+  TEST_ASSERT_TRUE(published_device(1, "vfd1"));
+}
+
+// While disconnected messages are queued, flush() publishes urgent ones first
+static void test_queued_while_disconnected()
+{
+  MQTT_client client("127.0.0.1");
+  client.setup_mqtt(module_mac, "H300");
+  client.disconnect();
+
+  TEST_ASSERT_TRUE(publish_device(client, "vfd1"));
+  TEST_ASSERT_TRUE(publish_device(client, "vfd2"));
+  TEST_ASSERT_TRUE(client.publish_request_result(1, true));
+  TEST_ASSERT_EQUAL(0, published.size());
+
+  client.connect(module_mac);
+  TEST_ASSERT_TRUE(client.flush(1000000));
+
+  TEST_ASSERT_EQUAL(3, published.size());
+  TEST_ASSERT_EQUAL_STRING("REQUEST_RESULT", published[0].first.c_str());
+  TEST_ASSERT_TRUE(published_device(1, "vfd1"));
+  TEST_ASSERT_TRUE(published_device(2, "vfd2"));
+  TEST_ASSERT_FALSE(client.values_lost);
+}
+
+// Once a publish failed the oldest telemetry gives way, its devices are flagged as lost
+static void test_full_queue_drops_oldest_telemetry()
+{
+  MQTT_client client("127.0.0.1");
+  client.setup_mqtt(module_mac, "H300");
+  client.disconnect();
+  char device_id[8];
+
+  for (uint8_t i = 0; i < MQTT_client::queue_slots; i++)
+  {
+    snprintf(device_id, sizeof(device_id), "vfd%u", i);
+    TEST_ASSERT_TRUE(publish_device(client, device_id));
+  }
+
+  TEST_ASSERT_FALSE(client.values_lost);
+
+  // full queue: vfd0 is tried and fails, then vfd1 is dropped for the request result
+  TEST_ASSERT_TRUE(publish_device(client, "vfd8"));
+  TEST_ASSERT_EQUAL(1, client.publish_failures);
+  TEST_ASSERT_EQUAL(0, client.queue_drops);
+
+  TEST_ASSERT_TRUE(client.publish_request_result(1, true));
+  TEST_ASSERT_EQUAL(1, client.queue_drops);
+  TEST_ASSERT_TRUE(client.values_lost);
+
+  client.connect(module_mac);
+  TEST_ASSERT_TRUE(client.flush(1000000));
+
+  TEST_ASSERT_EQUAL(MQTT_client::queue_slots, published.size());
+  TEST_ASSERT_EQUAL_STRING("REQUEST_RESULT", published[0].first.c_str());
+
+  for (uint8_t i = 1; i < MQTT_client::queue_slots; i++)
+  {
+    snprintf(device_id, sizeof(device_id), "vfd%u", i + 1);
+    TEST_ASSERT_TRUE(published_device(i, device_id));
+  }
+}
+
+// Urgent messages are not dropped for anything, a full queue of them refuses more
+static void test_urgent_never_dropped()
+{
+  MQTT_client client("127.0.0.1");
+  client.setup_mqtt(module_mac, "H300");
+  client.disconnect();
+
+  for (uint8_t i = 0; i < MQTT_client::queue_slots; i++)
+    TEST_ASSERT_TRUE(client.publish_request_result(i, true));
+
+  // the first one is tried, fails and keeps its slot
+  TEST_ASSERT_FALSE(client.publish_request_result(100, true));
+  TEST_ASSERT_FALSE(publish_device(client, "vfd1"));
+  TEST_ASSERT_EQUAL(1, client.publish_failures);
+  TEST_ASSERT_EQUAL(2, client.queue_drops);
+
+  client.connect(module_mac);
+  TEST_ASSERT_TRUE(client.flush(1000000));
+
+  TEST_ASSERT_EQUAL(MQTT_client::queue_slots, published.size());
+
+  for (const std::pair<std::string, std::string>& message : published)
+    TEST_ASSERT_EQUAL_STRING("REQUEST_RESULT", message.first.c_str());
+}
+
+// A failed flush keeps the urgent message for the next one, telemetry is given up
+static void test_urgent_retried_after_failed_publish()
+{
+  MQTT_client client("127.0.0.1");
+  client.setup_mqtt(module_mac, "H300");
+  client.disconnect();
+
+  TEST_ASSERT_TRUE(client.publish_request_result(1, false, "timeout"));
+  TEST_ASSERT_TRUE(publish_device(client, "vfd1"));
+
+  TEST_ASSERT_FALSE(client.flush(1000000));
+  TEST_ASSERT_FALSE(client.flush(1000000));
+  TEST_ASSERT_EQUAL(2, client.publish_failures);
+  TEST_ASSERT_EQUAL(0, published.size());
+  TEST_ASSERT_FALSE(client.values_lost);
+
+  client.connect(module_mac);
+  TEST_ASSERT_TRUE(client.flush(1000000));
+
+  TEST_ASSERT_EQUAL(2, published.size());
+  TEST_ASSERT_EQUAL_STRING("REQUEST_RESULT", published[0].first.c_str());
+  TEST_ASSERT_TRUE(published_device(1, "vfd1"));
+
+  // telemetry gets a single attempt
+  client.disconnect();
+  TEST_ASSERT_TRUE(publish_device(client, "vfd2"));
+  TEST_ASSERT_FALSE(client.flush(1000000));
+  TEST_ASSERT_TRUE(client.values_lost);
+
+  client.connect(module_mac);
+  TEST_ASSERT_TRUE(client.flush(1000000));
+  TEST_ASSERT_EQUAL(2, published.size());
+}
+
+// STATS does not depend on the VALUE_UPDATE buffer, which is small without devices
+static void test_stats_without_devices()
+{
+  MQTT_client client("127.0.0.1", 1883, 1024);
+  client.setup_mqtt(module_mac, "H300");
+  TEST_ASSERT_TRUE(client.reserve_value_update(0));
+
+  StaticJsonDocument<JSON_OBJECT_SIZE(4)> module_json;
+  module_json["interval_ms"] = 10000;
+  module_json["loop_us_avg"] = 120;
+  module_json["loop_us_max"] = 4500;
+  module_json["free_heap"] = 180000;
+  StaticJsonDocument<JSON_OBJECT_SIZE(0)> devices_json;
+
+  TEST_ASSERT_TRUE(client.publish_stats(module_json, devices_json));
+  TEST_ASSERT_EQUAL(0, client.oversize_count);
+  TEST_ASSERT_EQUAL(1, published.size());
+  TEST_ASSERT_EQUAL_STRING("STATS", published[0].first.c_str());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_dispatch_by_topic);
+  RUN_TEST(test_dispatch_from_broker);
+  RUN_TEST(test_route_limit);
+  RUN_TEST(test_published_directly);
+  RUN_TEST(test_queued_while_disconnected);
+  RUN_TEST(test_full_queue_drops_oldest_telemetry);
+  RUN_TEST(test_urgent_never_dropped);
+  RUN_TEST(test_urgent_retried_after_failed_publish);
+  RUN_TEST(test_stats_without_devices);
+  return UNITY_END();
+}
@@ -0,0 +1,145 @@
+#include <unity.h>
+#include <Msgpack_writer.hpp>
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+static void test_uint_smallest_encoding()
+{
+  uint8_t buffer[32];
+  Msgpack_writer writer(buffer, sizeof(buffer));
+  writer.write_uint(0x7F);
+  writer.write_uint(0x80);
+  writer.write_uint(0x100);
+  writer.write_uint(0x10000);
+
+  const uint8_t expected[] = {
+    0x7F,
+    0xCC, 0x80,
+    0xCD, 0x01, 0x00,
+    0xCE, 0x00, 0x01, 0x00, 0x00
+  };
+
+  TEST_ASSERT_EQUAL(sizeof(expected), writer.written());
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, buffer, sizeof(expected));
+  TEST_ASSERT_FALSE(writer.overflow());
+}
+
+static void test_nil_and_bool()
+{
+  uint8_t buffer[8];
+  Msgpack_writer writer(buffer, sizeof(buffer));
+  writer.write_nil();
+  writer.write_bool(true);
+  writer.write_bool(false);
+
+  const uint8_t expected[] = { 0xC0, 0xC3, 0xC2 };
+
+  TEST_ASSERT_EQUAL(sizeof(expected), writer.written());
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, buffer, sizeof(expected));
+}
+
+static void test_str()
+{
+  uint8_t buffer[64];
+  Msgpack_writer writer(buffer, sizeof(buffer));
+  writer.write_str("vfd1");
+
+  const uint8_t fixstr[] = { 0xA4, 'v', 'f', 'd', '1' };
+  TEST_ASSERT_EQUAL(sizeof(fixstr), writer.written());
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(fixstr, buffer, sizeof(fixstr));
+
+  // 32 characters no longer fit a fixstr
+  const char* const long_str = "0123456789abcdef0123456789abcdef";
+  Msgpack_writer str8_writer(buffer, sizeof(buffer));
+  str8_writer.write_str(long_str);
+
+  TEST_ASSERT_EQUAL(2 + 32, str8_writer.written());
+  TEST_ASSERT_EQUAL(0xD9, buffer[0]);
+  TEST_ASSERT_EQUAL(32, buffer[1]);
+  TEST_ASSERT_EQUAL_MEMORY(long_str, buffer + 2, 32);
+}
+
+static void test_map()
+{
+  uint8_t buffer[8];
+  Msgpack_writer writer(buffer, sizeof(buffer));
+  writer.write_map(2);
+  writer.write_map(16);
+
+  const uint8_t expected[] = { 0x82, 0xDE, 0x00, 0x10 };
+
+  TEST_ASSERT_EQUAL(sizeof(expected), writer.written());
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, buffer, sizeof(expected));
+}
+
+// The count of a map is patched in once its entries are written
+static void test_begin_end_map()
+{
+  uint8_t buffer[16];
+  Msgpack_writer writer(buffer, sizeof(buffer));
+  const size_t position = writer.begin_map();
+  writer.write_uint(1);
+  writer.write_bool(true);
+  writer.end_map(position, 1);
+
+  const uint8_t expected[] = { 0xDE, 0x00, 0x01, 0x01, 0xC3 };
+
+  TEST_ASSERT_EQUAL(sizeof(expected), writer.written());
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, buffer, sizeof(expected));
+}
+
+static void test_raw()
+{
+  uint8_t buffer[8];
+  const uint8_t entry[] = { 0xA1, 'a', 0x80 };
+  Msgpack_writer writer(buffer, sizeof(buffer));
+  writer.write_map(1);
+  writer.write_raw(entry, sizeof(entry));
+
+  const uint8_t expected[] = { 0x81, 0xA1, 'a', 0x80 };
+
+  TEST_ASSERT_EQUAL(sizeof(expected), writer.written());
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, buffer, sizeof(expected));
+}
+
+// Nothing is written past the buffer, a string which does not fit is left out whole
+static void test_overflow()
+{
+  uint8_t buffer[8] = {};
+  Msgpack_writer writer(buffer, 3);
+  writer.write_str("abc");
+
+  TEST_ASSERT_TRUE(writer.overflow());
+  TEST_ASSERT_EQUAL(1, writer.written());
+  TEST_ASSERT_EQUAL(0, buffer[3]);
+
+  // the header of the map did not fit, its count is not patched
+  Msgpack_writer map_writer(buffer, 2);
+  const size_t position = map_writer.begin_map();
+  map_writer.end_map(position, 5);
+
+  TEST_ASSERT_TRUE(map_writer.overflow());
+  TEST_ASSERT_EQUAL(2, map_writer.written());
+  TEST_ASSERT_EQUAL(0xDE, buffer[0]);
+  TEST_ASSERT_EQUAL(0x00, buffer[1]);
+  TEST_ASSERT_EQUAL(0, buffer[2]);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_uint_smallest_encoding);
+  RUN_TEST(test_nil_and_bool);
+  RUN_TEST(test_str);
+  RUN_TEST(test_map);
+  RUN_TEST(test_begin_end_map);
+  RUN_TEST(test_raw);
+  RUN_TEST(test_overflow);
+  return UNITY_END();
+}
@@ -0,0 +1,160 @@
+#include <unity.h>
+#include <stdint.h>
+#include <vector>
+#include <Poll_scheduler.hpp>
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+// Device popped at now, UINT16_MAX if none is due
+static uint16_t pop(Poll_scheduler& scheduler, const uint32_t now)
+{
+  uint16_t index;
+
+  return scheduler.pop_due(now, &index) ? index : UINT16_MAX;
+}
+
+// Two devices due at the same time, in either order
+static bool pop_pair(Poll_scheduler& scheduler, const uint32_t now, const uint16_t a, const uint16_t b)
+{
+  const uint16_t first = pop(scheduler, now);
+  const uint16_t second = pop(scheduler, now);
+
+  return (first == a && second == b) || (first == b && second == a);
+}
+
+static void test_staggered_over_period()
+{
+  Poll_scheduler scheduler;
+  scheduler.reset(std::vector<uint32_t>(4, 1000), 0);
+
+  TEST_ASSERT_EQUAL(0, pop(scheduler, 0));
+  TEST_ASSERT_EQUAL(UINT16_MAX, pop(scheduler, 0));
+  TEST_ASSERT_EQUAL(250, scheduler.until_due(0));
+  TEST_ASSERT_EQUAL(UINT16_MAX, pop(scheduler, 249));
+  TEST_ASSERT_EQUAL(1, pop(scheduler, 250));
+  TEST_ASSERT_EQUAL(2, pop(scheduler, 500));
+  TEST_ASSERT_EQUAL(3, pop(scheduler, 750));
+  TEST_ASSERT_EQUAL(0, pop(scheduler, 1000));
+  TEST_ASSERT_EQUAL(1, pop(scheduler, 1250));
+}
+
+static void test_staggered_per_rate()
+{
+  Poll_scheduler scheduler;
+  const uint32_t periods[] = { 1000, 200, 1000, 200 };
+  scheduler.reset(std::vector<uint32_t>(periods, periods + 4), 0);
+
+  // the first device of every rate is due right away
+  TEST_ASSERT_TRUE(pop_pair(scheduler, 0, 0, 1));
+  TEST_ASSERT_EQUAL(100, scheduler.until_due(0));
+  TEST_ASSERT_EQUAL(3, pop(scheduler, 100));
+  TEST_ASSERT_EQUAL(1, pop(scheduler, 200));
+  TEST_ASSERT_EQUAL(3, pop(scheduler, 300));
+  TEST_ASSERT_EQUAL(1, pop(scheduler, 400));
+  TEST_ASSERT_EQUAL(100, scheduler.until_due(400));
+  TEST_ASSERT_TRUE(pop_pair(scheduler, 500, 2, 3));
+}
+
+static void test_min_period()
+{
+  Poll_scheduler scheduler;
+  scheduler.reset(std::vector<uint32_t>(1, 0), 0);
+
+  TEST_ASSERT_EQUAL(0, pop(scheduler, 0));
+  TEST_ASSERT_EQUAL(Poll_scheduler::min_period_ms, scheduler.until_due(0));
+}
+
+static void test_skipped_periods_keep_cadence()
+{
+  Poll_scheduler scheduler;
+  scheduler.reset(std::vector<uint32_t>(1, 100), 0);
+
+  TEST_ASSERT_EQUAL(0, pop(scheduler, 0));
+  TEST_ASSERT_EQUAL(0, pop(scheduler, 350));
+
+  // due at 100, 200 and 300 were missed, the next poll stays on the 100 ms grid
+  TEST_ASSERT_EQUAL(50, scheduler.until_due(350));
+  TEST_ASSERT_EQUAL(UINT16_MAX, pop(scheduler, 399));
+  TEST_ASSERT_EQUAL(0, pop(scheduler, 400));
+
+  const Poll_scheduler::Stats stats = scheduler.take_stats();
+  TEST_ASSERT_EQUAL(3, stats.polls);
+  TEST_ASSERT_EQUAL(2, stats.skipped);
+  TEST_ASSERT_EQUAL(250, stats.max_lateness_ms);
+  TEST_ASSERT_EQUAL(250, stats.total_lateness_ms);
+  TEST_ASSERT_EQUAL(250, stats.max_jitter_ms);
+
+  const Poll_scheduler::Stats cleared = scheduler.take_stats();
+  TEST_ASSERT_EQUAL(0, cleared.polls);
+  TEST_ASSERT_EQUAL(0, cleared.skipped);
+}
+
+static void test_wrap_around_ordering()
+{
+  Poll_scheduler scheduler;
+  const uint32_t start = UINT32_MAX - 255;
+  scheduler.reset(std::vector<uint32_t>(2, 1000), start);
+
+  // device 1 is due at start + 500, past the wrap of the clock, yet before device 0 again
+  TEST_ASSERT_EQUAL(0, pop(scheduler, start));
+  TEST_ASSERT_EQUAL(500, scheduler.until_due(start));
+  TEST_ASSERT_EQUAL(UINT16_MAX, pop(scheduler, start + 499));
+  TEST_ASSERT_EQUAL(1, pop(scheduler, start + 500));
+  TEST_ASSERT_EQUAL(500, scheduler.until_due(start + 500));
+  TEST_ASSERT_EQUAL(0, pop(scheduler, start + 1000));
+  TEST_ASSERT_EQUAL(1, pop(scheduler, start + 1500));
+
+  const Poll_scheduler::Stats stats = scheduler.take_stats();
+  TEST_ASSERT_EQUAL(4, stats.polls);
+  TEST_ASSERT_EQUAL(0, stats.max_lateness_ms);
+  TEST_ASSERT_EQUAL(0, stats.max_jitter_ms);
+
+  // missed periods are skipped across the wrap as well
+  TEST_ASSERT_EQUAL(0, pop(scheduler, start + 3000));
+  TEST_ASSERT_EQUAL(1, pop(scheduler, start + 3000));
+  TEST_ASSERT_EQUAL(500, scheduler.until_due(start + 3000));
+  TEST_ASSERT_EQUAL(1, scheduler.take_stats().skipped);
+}
+
+static void test_reschedule_keeps_cadence()
+{
+  Poll_scheduler scheduler;
+  scheduler.reset(std::vector<uint32_t>(2, 100), 0);
+
+  TEST_ASSERT_EQUAL(0, pop(scheduler, 0));  // next due 100, device 1 due 50
+
+  // devices swap places, device 2 is new and device 1 changed its period
+  const uint32_t periods[] = { 100, 300, 100 };
+  const uint16_t previous[] = { 1, 0, Poll_scheduler::new_device };
+  scheduler.reschedule(
+    std::vector<uint32_t>(periods, periods + 3), std::vector<uint16_t>(previous, previous + 3), 10
+  );
+
+  // the kept device stays due at 50, the others start at once
+  TEST_ASSERT_TRUE(pop_pair(scheduler, 10, 1, 2));
+  TEST_ASSERT_EQUAL(40, scheduler.until_due(10));
+  TEST_ASSERT_EQUAL(0, pop(scheduler, 50));
+  TEST_ASSERT_EQUAL(2, pop(scheduler, 110));
+  TEST_ASSERT_EQUAL(0, pop(scheduler, 150));
+  TEST_ASSERT_EQUAL(2, pop(scheduler, 210));
+  TEST_ASSERT_EQUAL(0, pop(scheduler, 250));
+  TEST_ASSERT_EQUAL(60, scheduler.until_due(250));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_staggered_over_period);
+  RUN_TEST(test_staggered_per_rate);
+  RUN_TEST(test_min_period);
+  RUN_TEST(test_skipped_periods_keep_cadence);
+  RUN_TEST(test_wrap_around_ordering);
+  RUN_TEST(test_reschedule_keeps_cadence);
+  return UNITY_END();
+}
@@ -0,0 +1,161 @@
+#include <unity.h>
+#include <stdint.h>
+#include <map>
+#include <vector>
+#include <Arduino.h>
+#include <H300_sim.hpp>
+#include <Poller.hpp>
+
+// Writes are coalesced by a poller which is polled by the test instead of its task,
+// so that all commands pushed before a poll() are queued before the first is issued.
+static Read_planner* planner;
+static Poller* poller;
+static std::map<uint16_t, Command_result> results;  // by sequence number
+
+void setUp()
+{
+  results.clear();
+}
+
+void tearDown()
+{
+}
+
+static void push_write(const uint16_t register_addr, const uint16_t value, const uint16_t sequence_number,
+  const uint16_t batch_id = 0)
+{
+  Command command = {};
+  command.type = Command::Type::WRITE;
+  command.generation = 1;
+  command.device_index = 0;
+  command.register_addr = register_addr;
+  command.value = value;
+  command.sequence_number = sequence_number;
+  command.batch_id = batch_id;
+
+  TEST_ASSERT_TRUE(poller->commands.push(command));
+}
+
+// Poll until count results arrived, or give up after a second
+static void run(const size_t count)
+{
+  const uint32_t start = millis();
+  Command_result result;
+
+  while (results.size() < count && millis() - start < 1000)
+  {
+    poller->poll();
+
+    while (poller->results.pop(result))
+    {
+      TEST_ASSERT_EQUAL(0, results.count(result.sequence_number));
+      results[result.sequence_number] = result;
+    }
+
+    delay(1);
+  }
+
+  TEST_ASSERT_EQUAL(count, results.size());
+}
+
+static void assert_result(const uint16_t sequence_number, const uint8_t result, const uint16_t batch_id = 0)
+{
+  TEST_ASSERT_EQUAL(1, results.count(sequence_number));
+  TEST_ASSERT_EQUAL(result, results[sequence_number].result);
+  TEST_ASSERT_EQUAL(batch_id, results[sequence_number].batch_id);
+}
+
+static void test_single_write()
+{
+  push_write(H300::set_freq_register, 2500, 1);
+  run(1);
+
+  assert_result(1, 0);
+}
+
+static void test_coalesced_writes_share_result()
+{
+  for (uint16_t i = 0; i < 5; i++)
+    push_write(H300::set_freq_register, 1000 + i, 2 + i);
+
+  run(5);
+
+  for (uint16_t i = 0; i < 5; i++)
+    assert_result(2 + i, 0);
+}
+
+static void test_every_superseded_run_answered()
+{
+  // runs 10-12, 20, 30 and 40 are superseded by 50, no run is left for 60
+  const uint16_t sequence_numbers[] = { 10, 11, 12, 20, 30, 40, 50, 60 };
+
+  for (uint16_t sequence_number : sequence_numbers)
+    push_write(H300::accel_time_register, sequence_number, sequence_number);
+
+  run(8);
+
+  for (uint8_t i = 0; i < 7; i++)
+    assert_result(sequence_numbers[i], 0);
+
+  assert_result(60, Poller::queue_full);
+}
+
+static void test_runs_split_by_batch()
+{
+  push_write(H300::decel_time_register, 100, 70, 5);
+  push_write(H300::decel_time_register, 101, 71, 6);
+  push_write(H300::decel_time_register, 102, 72, 6);
+  run(3);
+
+  assert_result(70, 0, 5);
+  assert_result(71, 0, 6);
+  assert_result(72, 0, 6);
+}
+
+static void test_stale_generation()
+{
+  Command command = {};
+  command.type = Command::Type::WRITE;
+  command.generation = 2;
+  command.register_addr = H300::set_freq_register;
+  command.sequence_number = 80;
+
+  TEST_ASSERT_TRUE(poller->commands.push(command));
+  run(1);
+
+  assert_result(80, Poller::stale_config);
+}
+
+int main()
+{
+  planner = new Read_planner(Modbus_RTU::timing(Bus_config::default_baud_rate), H300::response_delay_us);
+
+  for (const Datapoint& datapoint : Datapoints::table)
+    if (datapoint.readable)
+      planner->add_register(datapoint.register_addr);
+
+  const H300_sim::Faults faults = { 0, 0, 0, 0 };
+  Serial2.attach(new H300_sim(1, Bus_config::default_baud_rate, faults));
+
+  poller = new Poller(*planner, 10);
+
+  Device_config config = {};
+  config.generation = 1;
+  config.devices = new std::vector<H300>();
+  config.devices->emplace_back(0, "vfd1", 1, 500);
+  config.bus_count = 1;
+  config.buses[0] = {
+    Bus_config::default_uart, Bus_config::default_pin, Bus_config::default_pin, Bus_config::default_de_pin,
+    Bus_config::default_re_neg_pin, Bus_config::default_baud_rate, Modbus_RTU::Parity::NONE, 200
+  };
+  poller->configs.push(config);
+  poller->poll();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_single_write);
+  RUN_TEST(test_coalesced_writes_share_result);
+  RUN_TEST(test_every_superseded_run_answered);
+  RUN_TEST(test_runs_split_by_batch);
+  RUN_TEST(test_stale_generation);
+  return UNITY_END();
+}
@@ -0,0 +1,125 @@
+#include <unity.h>
+#include <Read_planner.hpp>
+
+// 500 us per character and 2 ms silence: a frame costs 10.5 ms, as much as 10 gap
+// registers (two characters each), so registers up to 10 apart share one read
+static const Modbus_RTU::Timing timing = { 500, 2000 };
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+static void test_registers_sorted_and_unique()
+{
+  Read_planner planner(timing, 0);
+
+  TEST_ASSERT_TRUE(planner.add_register(5));
+  TEST_ASSERT_TRUE(planner.add_register(1));
+  TEST_ASSERT_TRUE(planner.add_register(3));
+  TEST_ASSERT_TRUE(planner.add_register(3));
+
+  TEST_ASSERT_EQUAL(3, planner.register_count());
+  TEST_ASSERT_EQUAL(1, planner.register_at(0));
+  TEST_ASSERT_EQUAL(3, planner.register_at(1));
+  TEST_ASSERT_EQUAL(5, planner.register_at(2));
+  TEST_ASSERT_EQUAL(2, planner.index_of(5));
+  TEST_ASSERT_EQUAL(-1, planner.index_of(4));
+}
+
+static void test_gap_cheaper_than_frame_merged()
+{
+  Read_planner planner(timing, 0);
+  planner.add_register(100);
+  planner.add_register(111);
+
+  TEST_ASSERT_EQUAL(1, planner.range_count());
+  TEST_ASSERT_EQUAL(100, planner.range_at(0).start);
+  TEST_ASSERT_EQUAL(12, planner.range_at(0).count);
+  TEST_ASSERT_TRUE(planner.planned_scan_us() < planner.naive_scan_us());
+}
+
+static void test_gap_dearer_than_frame_split()
+{
+  Read_planner planner(timing, 0);
+  planner.add_register(100);
+  planner.add_register(112);
+
+  TEST_ASSERT_EQUAL(2, planner.range_count());
+  TEST_ASSERT_EQUAL(100, planner.range_at(0).start);
+  TEST_ASSERT_EQUAL(1, planner.range_at(0).count);
+  TEST_ASSERT_EQUAL(112, planner.range_at(1).start);
+  TEST_ASSERT_EQUAL(1, planner.range_at(1).count);
+  TEST_ASSERT_EQUAL(planner.naive_scan_us(), planner.planned_scan_us());
+}
+
+// However slow the drive answers, a read never spans more than the response buffer
+static void test_span_limited()
+{
+  Read_planner planner(timing, 1000000);
+  planner.add_register(0);
+  planner.add_register(63);
+
+  TEST_ASSERT_EQUAL(1, planner.range_count());
+  TEST_ASSERT_EQUAL(Read_planner::max_span, planner.range_at(0).count);
+
+  planner.add_register(64);
+
+  TEST_ASSERT_EQUAL(2, planner.range_count());
+  TEST_ASSERT_EQUAL(64, planner.range_at(1).start);
+}
+
+static void test_register_limit()
+{
+  Read_planner planner(timing, 0);
+
+  for (uint16_t i = 0; i < Read_planner::max_registers; i++)
+    TEST_ASSERT_TRUE(planner.add_register(100 * i));
+
+  TEST_ASSERT_FALSE(planner.add_register(1));
+  TEST_ASSERT_TRUE(planner.add_register(100));
+  TEST_ASSERT_EQUAL(Read_planner::max_registers, planner.register_count());
+  TEST_ASSERT_EQUAL(Read_planner::max_registers, planner.range_count());
+}
+
+// A merged read the drive rejects falls back to single reads, later ranges keep their order
+static void test_split_range()
+{
+  Read_planner planner(timing, 0);
+  planner.add_register(100);
+  planner.add_register(102);
+  planner.add_register(104);
+  planner.add_register(200);
+
+  TEST_ASSERT_EQUAL(2, planner.range_count());
+
+  planner.split_range(0);
+
+  TEST_ASSERT_EQUAL(4, planner.range_count());
+
+  for (uint8_t i = 0; i < planner.range_count(); i++)
+  {
+    TEST_ASSERT_EQUAL(planner.register_at(i), planner.range_at(i).start);
+    TEST_ASSERT_EQUAL(1, planner.range_at(i).count);
+  }
+
+  // single reads are left as they are
+  planner.split_range(3);
+  planner.split_range(4);
+  TEST_ASSERT_EQUAL(4, planner.range_count());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_registers_sorted_and_unique);
+  RUN_TEST(test_gap_cheaper_than_frame_merged);
+  RUN_TEST(test_gap_dearer_than_frame_split);
+  RUN_TEST(test_span_limited);
+  RUN_TEST(test_register_limit);
+  RUN_TEST(test_split_range);
+  return UNITY_END();
+}
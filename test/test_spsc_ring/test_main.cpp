@@ -0,0 +1,109 @@
+#include <unity.h>
+#include <stdint.h>
+#include <thread>
+#include <SPSC_ring.hpp>
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+static void test_empty()
+{
+  SPSC_ring<int, 4> ring;
+  int item = -1;
+
+  TEST_ASSERT_TRUE(ring.empty());
+  TEST_ASSERT_EQUAL(0, ring.size());
+  TEST_ASSERT_FALSE(ring.pop(item));
+  TEST_ASSERT_EQUAL(-1, item);
+}
+
+static void test_full()
+{
+  SPSC_ring<int, 4> ring;
+
+  for (int i = 0; i < 4; i++)
+    TEST_ASSERT_TRUE(ring.push(i));
+
+  TEST_ASSERT_EQUAL(4, ring.size());
+  TEST_ASSERT_FALSE(ring.push(4));
+
+  // a pop makes space for exactly one item
+  int item;
+  TEST_ASSERT_TRUE(ring.pop(item));
+  TEST_ASSERT_EQUAL(0, item);
+  TEST_ASSERT_TRUE(ring.push(4));
+  TEST_ASSERT_FALSE(ring.push(5));
+}
+
+// Positions keep counting past the capacity, items come out in order across the wrap
+static void test_wrap_around()
+{
+  SPSC_ring<int, 4> ring;
+  int next_push = 0;
+  int next_pop = 0;
+
+  for (int round = 0; round < 10; round++)
+  {
+    for (int i = 0; i < 3; i++)
+      TEST_ASSERT_TRUE(ring.push(next_push++));
+
+    for (int i = 0; i < 3; i++)
+    {
+      int item;
+      TEST_ASSERT_TRUE(ring.pop(item));
+      TEST_ASSERT_EQUAL(next_pop++, item);
+    }
+
+    TEST_ASSERT_TRUE(ring.empty());
+  }
+}
+
+// The poller task pushes while the main loop pops, nothing may get lost or reordered
+static void test_producer_consumer()
+{
+  static constexpr uint32_t item_count = 200000;
+  SPSC_ring<uint32_t, 16> ring;
+
+  std::thread producer([&ring]() {
+    for (uint32_t i = 0; i < item_count; i++)
+      while (!ring.push(i))
+        std::this_thread::yield();
+  });
+
+  uint32_t expected = 0;
+  bool in_order = true;
+
+  while (expected < item_count)
+  {
+    uint32_t item;
+
+    if (!ring.pop(item))
+    {
+      std::this_thread::yield();
+      continue;
+    }
+
+    in_order &= item == expected;
+    expected++;
+  }
+
+  producer.join();
+
+  TEST_ASSERT_TRUE(in_order);
+  TEST_ASSERT_TRUE(ring.empty());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_empty);
+  RUN_TEST(test_full);
+  RUN_TEST(test_wrap_around);
+  RUN_TEST(test_producer_consumer);
+  return UNITY_END();
+}